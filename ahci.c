@@ -0,0 +1,534 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: ahci.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: AHCI driver for SATA disks (ICH9 on QEMU's q35), with native command queuing.
+    Dependencies: types.h, vga.h, idt.h, kutils.h, pci.h, ata.h, blkq.h, ahci.h
+
+    Suggested Changes/Todo:
+    Hot plug, port multipliers, and ATAPI devices aren't handled.
+
+*/
+
+/*
+ * The HBA is driven through memory-mapped registers at ABAR (BAR5). Each
+ * port gets a command list of 32 headers, a FIS receive area, and a command
+ * table per slot holding the command FIS and a PRD entry per scatter-gather
+ * segment. The kernel runs without paging, so buffers are handed to the HBA
+ * by their addresses as-is.
+ *
+ * Disks that support NCQ take READ/WRITE FPDMA QUEUED with one tag per
+ * command slot, so the block queue can keep up to 32 commands outstanding
+ * and the drive completes them in whatever order suits it. Other disks get
+ * READ/WRITE DMA EXT one at a time. Completion is found by comparing the
+ * slots we issued against PxSACT/PxCI, either after the HBA's interrupt or
+ * by polling if the interrupt line couldn't be hooked.
+ */
+
+#include "types.h"
+#include "vga.h"
+#include "idt.h"
+#include "kutils.h"
+#include "pci.h"
+#include "ata.h"
+#include "blkq.h"
+#include "ahci.h"
+
+// Generic host control registers (offsets from ABAR)
+#define AHCI_CAP   0x00
+#define AHCI_GHC   0x04
+#define AHCI_IS    0x08
+#define AHCI_PI    0x0C
+
+#define AHCI_CAP_SNCQ  (1u << 30)  // HBA supports native command queuing
+#define AHCI_GHC_IE    (1u << 1)   // Interrupt enable
+#define AHCI_GHC_AE    (1u << 31)  // AHCI mode enable
+
+// Port registers (offsets from ABAR + 0x100 + port * 0x80)
+#define AHCI_PxCLB   0x00
+#define AHCI_PxCLBU  0x04
+#define AHCI_PxFB    0x08
+#define AHCI_PxFBU   0x0C
+#define AHCI_PxIS    0x10
+#define AHCI_PxIE    0x14
+#define AHCI_PxCMD   0x18
+#define AHCI_PxTFD   0x20
+#define AHCI_PxSIG   0x24
+#define AHCI_PxSSTS  0x28
+#define AHCI_PxSERR  0x30
+#define AHCI_PxSACT  0x34
+#define AHCI_PxCI    0x38
+
+#define AHCI_PxCMD_ST   (1u << 0)   // Start processing the command list
+#define AHCI_PxCMD_FRE  (1u << 4)   // FIS receive enable
+#define AHCI_PxCMD_FR   (1u << 14)  // FIS receive running
+#define AHCI_PxCMD_CR   (1u << 15)  // Command list running
+
+#define AHCI_PxIS_ERRORS  0x78000000  // Task file, host bus fatal/data, interface fatal errors
+#define AHCI_PxIE_DEFAULT 0x7800000F  // D2H, PIO setup, DMA setup, set device bits + errors
+
+#define AHCI_SIG_ATA    0x00000101  // Plain SATA disk
+#define AHCI_SSTS_DET   0x0F
+#define AHCI_DET_READY  3           // Device present and PHY communication up
+
+#define AHCI_FIS_H2D    0x27
+
+// Commands
+#define AHCI_CMD_READ_DMA      0xC8
+#define AHCI_CMD_WRITE_DMA     0xCA
+#define AHCI_CMD_READ_DMA_EXT  0x25
+#define AHCI_CMD_WRITE_DMA_EXT 0x35
+#define AHCI_CMD_READ_FPDMA    0x60  // READ FPDMA QUEUED (NCQ)
+#define AHCI_CMD_WRITE_FPDMA   0x61  // WRITE FPDMA QUEUED (NCQ)
+#define AHCI_CMD_FLUSH_EXT     0xEA
+#define AHCI_CMD_IDENTIFY      0xEC
+
+#define AHCI_TIMEOUT_TICKS (5 * TIMER_HZ)
+#define AHCI_PRD_ENTRIES   BLKQ_MAX_SEGMENTS  // One per segment of a merged command
+
+typedef struct {
+    u16 flags;             // FIS length in dwords (bits 4:0), write (bit 6)
+    u16 prdtl;             // PRD entries in the command table
+    volatile u32 prdbc;    // Bytes transferred, updated by the HBA
+    u32 ctba;              // Command table address (128-byte aligned)
+    u32 ctbau;
+    u32 reserved[4];
+} PACKED ahci_cmd_header_t;
+
+typedef struct {
+    u32 dba;               // Data address (word aligned)
+    u32 dbau;
+    u32 reserved;
+    u32 dbc;               // Byte count - 1 (bits 21:0)
+} PACKED ahci_prd_t;
+
+// 128 bytes of header plus the PRD table, a multiple of 128 so an array of
+// them stays aligned
+typedef struct {
+    u8 cfis[64];
+    u8 acmd[16];
+    u8 reserved[48];
+    ahci_prd_t prdt[AHCI_PRD_ENTRIES];
+} PACKED ahci_cmd_table_t;
+
+typedef struct {
+    u32 regs;                          // Address of this port's registers
+    u32 index;                         // Port number on the HBA
+    bool ncq;                          // Queue commands with FPDMA QUEUED
+    bool lba48;
+    u32 issued;                        // Slots with a command in flight
+    u32 unkicked;                      // Slots built but not yet handed to the HBA
+    blk_cmd_t* cmds[AHCI_MAX_SLOTS];
+    volatile u32 irq_errors;           // Error bits seen by the interrupt handler
+    u64 total_sectors;
+    char model[41];
+    ahci_cmd_header_t* cmd_list;
+    ahci_cmd_table_t* tables;
+    blkdev_t dev;
+} ahci_port_t;
+
+static ahci_cmd_header_t ahci_cmd_lists[AHCI_MAX_PORTS][AHCI_MAX_SLOTS] __attribute__((aligned(1024)));
+static u8 ahci_fis_areas[AHCI_MAX_PORTS][256] __attribute__((aligned(256)));
+static ahci_cmd_table_t ahci_tables[AHCI_MAX_PORTS][AHCI_MAX_SLOTS] __attribute__((aligned(128)));
+static u16 ahci_identify_data[256];
+
+static ahci_port_t ahci_ports[AHCI_MAX_PORTS];
+static u32 ahci_port_count = 0;
+static u32 ahci_abar = 0;      // HBA registers, 0 when there is no AHCI controller
+static u32 ahci_slots = 1;     // Command slots the HBA implements
+
+static u32 ahci_read(u32 reg) {
+    return *(volatile u32*)(ahci_abar + reg);
+}
+
+static void ahci_write(u32 reg, u32 value) {
+    *(volatile u32*)(ahci_abar + reg) = value;
+}
+
+static u32 ahci_port_read(ahci_port_t* port, u32 reg) {
+    return *(volatile u32*)(port->regs + reg);
+}
+
+static void ahci_port_write(ahci_port_t* port, u32 reg, u32 value) {
+    *(volatile u32*)(port->regs + reg) = value;
+}
+
+// Wait for the bits in mask to clear in a port register
+static bool ahci_wait_clear(ahci_port_t* port, u32 reg, u32 mask) {
+    u32 start = timer_ticks;
+    while(ahci_port_read(port, reg) & mask) {
+        if(timer_ticks - start > AHCI_TIMEOUT_TICKS) return false;
+    }
+    return true;
+}
+
+// Stop the command list and FIS receive engines so the port can be (re)programmed
+static bool ahci_port_stop(ahci_port_t* port) {
+    u32 cmd = ahci_port_read(port, AHCI_PxCMD);
+    ahci_port_write(port, AHCI_PxCMD, cmd & ~AHCI_PxCMD_ST);
+    if(!ahci_wait_clear(port, AHCI_PxCMD, AHCI_PxCMD_CR)) return false;
+
+    cmd = ahci_port_read(port, AHCI_PxCMD);
+    ahci_port_write(port, AHCI_PxCMD, cmd & ~AHCI_PxCMD_FRE);
+    return ahci_wait_clear(port, AHCI_PxCMD, AHCI_PxCMD_FR);
+}
+
+static bool ahci_port_start(ahci_port_t* port) {
+    ahci_port_write(port, AHCI_PxSERR, 0xFFFFFFFF);
+    ahci_port_write(port, AHCI_PxIS, 0xFFFFFFFF);
+    if(!ahci_wait_clear(port, AHCI_PxTFD, 0x88)) return false;  // BSY or DRQ
+
+    u32 cmd = ahci_port_read(port, AHCI_PxCMD);
+    ahci_port_write(port, AHCI_PxCMD, cmd | AHCI_PxCMD_FRE);
+    ahci_port_write(port, AHCI_PxCMD, cmd | AHCI_PxCMD_FRE | AHCI_PxCMD_ST);
+    return true;
+}
+
+// Fill in a slot's command header, command FIS and PRD table. Queued commands
+// carry the tag in the count field and the sector count in the features field.
+static bool ahci_build(ahci_port_t* port, u32 slot, u8 command, u64 lba, u32 count,
+                       blk_segment_t* segs, u32 nsegs, bool write) {
+    ahci_cmd_header_t* header = &port->cmd_list[slot];
+    ahci_cmd_table_t* table = &port->tables[slot];
+    u8* fis = table->cfis;
+    bool queued = (command == AHCI_CMD_READ_FPDMA || command == AHCI_CMD_WRITE_FPDMA);
+    bool lba28 = (command == AHCI_CMD_READ_DMA || command == AHCI_CMD_WRITE_DMA);
+
+    for(u32 i = 0; i < 20; i++) fis[i] = 0;
+    fis[0] = AHCI_FIS_H2D;
+    fis[1] = 0x80;                            // This FIS carries a command
+    fis[2] = command;
+    fis[4] = lba & 0xFF;
+    fis[5] = (lba >> 8) & 0xFF;
+    fis[6] = (lba >> 16) & 0xFF;
+    fis[7] = 0x40;                            // LBA mode
+    if(lba28) {
+        fis[7] |= (lba >> 24) & 0x0F;
+    } else {
+        fis[8] = (lba >> 24) & 0xFF;
+        fis[9] = (lba >> 32) & 0xFF;
+        fis[10] = (lba >> 40) & 0xFF;
+    }
+    if(queued) {
+        fis[3] = count & 0xFF;
+        fis[11] = (count >> 8) & 0xFF;
+        fis[12] = slot << 3;                  // NCQ tag
+    } else {
+        fis[12] = count & 0xFF;               // 256 is sent as 0 on LBA28 commands
+        fis[13] = (count >> 8) & 0xFF;
+    }
+
+    for(u32 i = 0; i < nsegs; i++) {
+        u32 addr = (u32)segs[i].buffer;
+        if(addr & 1) return false;
+        table->prdt[i].dba = addr;
+        table->prdt[i].dbau = 0;
+        table->prdt[i].reserved = 0;
+        table->prdt[i].dbc = segs[i].count * 512 - 1;
+    }
+
+    header->flags = 5 | (write ? 0x40 : 0);  // 5-dword command FIS
+    header->prdtl = nsegs;
+    header->prdbc = 0;
+    return true;
+}
+
+static u8 ahci_rw_command(ahci_port_t* port, u64 lba, u32 count, bool write) {
+    if(port->ncq) return write ? AHCI_CMD_WRITE_FPDMA : AHCI_CMD_READ_FPDMA;
+    if(port->lba48 || lba + count > 0x10000000ULL) return write ? AHCI_CMD_WRITE_DMA_EXT : AHCI_CMD_READ_DMA_EXT;
+    return write ? AHCI_CMD_WRITE_DMA : AHCI_CMD_READ_DMA;
+}
+
+static void ahci_report_error(ahci_port_t* port) {
+    u32 tfd = ahci_port_read(port, AHCI_PxTFD);
+    kprint("Error: AHCI command failed on ");
+    kprint(port->dev.name);
+    kprint(" (status ");
+    kprint_hex(tfd & 0xFF);
+    kprint(", error ");
+    kprint_hex((tfd >> 8) & 0xFF);
+    kprint(")\n");
+}
+
+// Error bits for the port, whether the interrupt handler got to them first or not
+static u32 ahci_port_errors(ahci_port_t* port) {
+    __asm__ volatile("cli");
+    u32 errors = port->irq_errors;
+    port->irq_errors = 0;
+    __asm__ volatile("sti");
+
+    u32 is = ahci_port_read(port, AHCI_PxIS);
+    ahci_port_write(port, AHCI_PxIS, is);
+    return errors | (is & AHCI_PxIS_ERRORS);
+}
+
+// Run an unqueued command in slot 0 and wait for it. Only used while nothing
+// else is outstanding on the port.
+static bool ahci_exec(ahci_port_t* port) {
+    u32 start = timer_ticks;
+    u32 errors = 0;
+
+    ahci_port_errors(port);  // Drop anything stale
+    ahci_port_write(port, AHCI_PxCI, 1);
+
+    while(ahci_port_read(port, AHCI_PxCI) & 1) {
+        errors = ahci_port_errors(port);
+        if(errors) break;
+        if(timer_ticks - start > AHCI_TIMEOUT_TICKS) {
+            kprint("Error: AHCI command timed out\n");
+            return false;
+        }
+    }
+    errors |= ahci_port_errors(port);
+    if(errors || (ahci_port_read(port, AHCI_PxTFD) & 0x01)) {
+        ahci_report_error(port);
+        return false;
+    }
+    return true;
+}
+
+// An error or timeout aborts everything the drive had queued. Restart the
+// port, then redo each command on its own so only the one that really fails
+// is reported as failed.
+static void ahci_recover(ahci_port_t* port) {
+    blk_cmd_t* cmds[AHCI_MAX_SLOTS];
+    u32 n = 0;
+
+    ahci_report_error(port);
+    for(u32 slot = 0; slot < AHCI_MAX_SLOTS; slot++) {
+        if(port->issued & (1u << slot)) cmds[n++] = port->cmds[slot];
+    }
+    port->issued = 0;
+
+    bool restarted = ahci_port_stop(port) && ahci_port_start(port);
+    if(!restarted) kprint("Error: AHCI port didn't restart\n");
+
+    for(u32 i = 0; i < n; i++) {
+        blk_cmd_t* cmd = cmds[i];
+        bool ok = restarted;
+        if(ok) {
+            u8 command = cmd->write ? AHCI_CMD_WRITE_DMA_EXT : AHCI_CMD_READ_DMA_EXT;
+            if(!port->lba48) command = cmd->write ? AHCI_CMD_WRITE_DMA : AHCI_CMD_READ_DMA;
+            ok = ahci_build(port, 0, command, cmd->lba, cmd->count, cmd->segs, cmd->nsegs, cmd->write) &&
+                 ahci_exec(port);
+        }
+        blkq_complete(cmd, ok);
+    }
+}
+
+// Block device operations
+static bool ahci_blk_start(blkdev_t* dev, blk_cmd_t* cmd) {
+    ahci_port_t* port = (ahci_port_t*)dev->driver;
+    u32 slot;
+
+    for(slot = 0; slot < dev->max_inflight; slot++) {
+        if(!(port->issued & (1u << slot))) break;
+    }
+    if(slot == dev->max_inflight) return false;
+
+    u8 command = ahci_rw_command(port, cmd->lba, cmd->count, cmd->write);
+    if(!ahci_build(port, slot, command, cmd->lba, cmd->count, cmd->segs, cmd->nsegs, cmd->write)) {
+        blkq_complete(cmd, false);
+        return true;
+    }
+
+    port->cmds[slot] = cmd;
+    port->issued |= 1u << slot;
+    port->unkicked |= 1u << slot;
+    return true;
+}
+
+// Issue every command built in this pass with one write to SACT and CI
+static void ahci_blk_kick(blkdev_t* dev) {
+    ahci_port_t* port = (ahci_port_t*)dev->driver;
+
+    if(!port->unkicked) return;
+    if(port->ncq) ahci_port_write(port, AHCI_PxSACT, port->unkicked);
+    ahci_port_write(port, AHCI_PxCI, port->unkicked);
+    port->unkicked = 0;
+}
+
+static void ahci_blk_poll(blkdev_t* dev) {
+    ahci_port_t* port = (ahci_port_t*)dev->driver;
+
+    if(ahci_port_errors(port)) {
+        ahci_recover(port);
+        return;
+    }
+
+    // A queued command is done once its bit is gone from both SACT and CI
+    u32 busy = ahci_port_read(port, AHCI_PxCI);
+    if(port->ncq) busy |= ahci_port_read(port, AHCI_PxSACT);
+    u32 done = port->issued & ~busy;
+
+    for(u32 slot = 0; slot < AHCI_MAX_SLOTS && port->issued; slot++) {
+        u32 bit = 1u << slot;
+        if(done & bit) {
+            port->issued &= ~bit;
+            blkq_complete(port->cmds[slot], true);
+        } else if((port->issued & bit) && timer_ticks - port->cmds[slot]->start_tick > AHCI_TIMEOUT_TICKS) {
+            kprint("Error: AHCI command timed out\n");
+            ahci_recover(port);
+            return;
+        }
+    }
+}
+
+static bool ahci_blk_flush(blkdev_t* dev) {
+    ahci_port_t* port = (ahci_port_t*)dev->driver;
+
+    if(port->issued) return false;
+    ahci_build(port, 0, AHCI_CMD_FLUSH_EXT, 0, 0, 0, 0, false);
+    return ahci_exec(port);
+}
+
+// Shared PCI interrupt: acknowledge every port that interrupted and wake the queue
+static void ahci_irq(void* context) {
+    (void)context;
+    u32 pending = ahci_read(AHCI_IS);
+    if(!pending) return;  // Another device on the same line
+
+    for(u32 i = 0; i < ahci_port_count; i++) {
+        ahci_port_t* port = &ahci_ports[i];
+        if(pending & (1u << port->index)) {
+            u32 is = ahci_port_read(port, AHCI_PxIS);
+            ahci_port_write(port, AHCI_PxIS, is);
+            port->irq_errors |= is & AHCI_PxIS_ERRORS;
+        }
+    }
+    ahci_write(AHCI_IS, pending);
+    blkq_notify();
+}
+
+// Give the port its memory, start it, and IDENTIFY the disk behind it
+static bool ahci_port_init(ahci_port_t* port, u32 index, u32 n) {
+    port->regs = ahci_abar + 0x100 + index * 0x80;
+    port->index = index;
+    port->issued = 0;
+    port->unkicked = 0;
+    port->irq_errors = 0;
+    port->cmd_list = ahci_cmd_lists[n];
+    port->tables = ahci_tables[n];
+
+    if(!ahci_port_stop(port)) return false;
+
+    for(u32 slot = 0; slot < AHCI_MAX_SLOTS; slot++) {
+        port->cmd_list[slot].flags = 0;
+        port->cmd_list[slot].prdtl = 0;
+        port->cmd_list[slot].prdbc = 0;
+        port->cmd_list[slot].ctba = (u32)&port->tables[slot];
+        port->cmd_list[slot].ctbau = 0;
+    }
+    ahci_port_write(port, AHCI_PxCLB, (u32)port->cmd_list);
+    ahci_port_write(port, AHCI_PxCLBU, 0);
+    ahci_port_write(port, AHCI_PxFB, (u32)ahci_fis_areas[n]);
+    ahci_port_write(port, AHCI_PxFBU, 0);
+    if(!ahci_port_start(port)) return false;
+
+    blk_segment_t seg = { ahci_identify_data, 1 };
+    ahci_build(port, 0, AHCI_CMD_IDENTIFY, 0, 0, &seg, 1, false);
+    port->dev.name[0] = 's';
+    port->dev.name[1] = 'd';
+    port->dev.name[2] = 'a' + n;
+    port->dev.name[3] = '\0';
+    if(!ahci_exec(port)) return false;
+
+    u16* id = ahci_identify_data;
+    port->total_sectors = ata_identify_sectors(id);
+    port->lba48 = (id[83] & (1 << 10)) != 0;
+    ata_identify_string(id, port->model, 27, 20);
+
+    // NCQ needs both the HBA and the drive; word 75 holds the drive's queue depth - 1
+    u32 depth = 1;
+    port->ncq = (ahci_read(AHCI_CAP) & AHCI_CAP_SNCQ) && (id[76] & (1 << 8));
+    if(port->ncq) {
+        depth = (id[75] & 0x1F) + 1;
+        if(depth > ahci_slots) depth = ahci_slots;
+    }
+
+    ahci_port_write(port, AHCI_PxIE, AHCI_PxIE_DEFAULT);
+    port->dev.sectors = port->total_sectors;
+    port->dev.max_inflight = depth;
+    port->dev.start = ahci_blk_start;
+    port->dev.kick = ahci_blk_kick;
+    port->dev.poll = ahci_blk_poll;
+    port->dev.flush = ahci_blk_flush;
+    port->dev.driver = port;
+    return true;
+}
+
+void ahci_init(void) {
+    pci_device_t hba;
+
+    if(ahci_abar) return;  // Already set up
+    if(!pci_find_class(0x01, 0x06, &hba)) return;  // Mass storage, SATA
+    if(hba.prog_if != 0x01) return;                // Not in AHCI mode
+
+    u32 bar5 = pci_read_bar(&hba, 5);
+    if(bar5 & 0x01) return;                        // ABAR must be memory space
+
+    pci_enable_bus_master(&hba);
+    ahci_abar = bar5 & 0xFFFFFFF0;
+    ahci_write(AHCI_GHC, ahci_read(AHCI_GHC) | AHCI_GHC_AE);
+    ahci_slots = ((ahci_read(AHCI_CAP) >> 8) & 0x1F) + 1;
+
+    bool irq = irq_register(pci_interrupt_line(&hba), ahci_irq, 0);
+    u32 implemented = ahci_read(AHCI_PI);
+
+    for(u32 index = 0; index < 32 && ahci_port_count < AHCI_MAX_PORTS; index++) {
+        if(!(implemented & (1u << index))) continue;
+
+        u32 regs = ahci_abar + 0x100 + index * 0x80;
+        u32 ssts = *(volatile u32*)(regs + AHCI_PxSSTS);
+        u32 sig = *(volatile u32*)(regs + AHCI_PxSIG);
+        if((ssts & AHCI_SSTS_DET) != AHCI_DET_READY || sig != AHCI_SIG_ATA) continue;  // Empty, or ATAPI
+
+        ahci_port_t* port = &ahci_ports[ahci_port_count];
+        if(!ahci_port_init(port, index, ahci_port_count)) {
+            kprint("AHCI port "); kprint_dec(index); kprint(" failed to start\n");
+            continue;
+        }
+        port->dev.polled = !irq;
+        ahci_port_count++;
+    }
+
+    ahci_write(AHCI_IS, 0xFFFFFFFF);
+    if(irq) ahci_write(AHCI_GHC, ahci_read(AHCI_GHC) | AHCI_GHC_IE);
+
+    for(u32 i = 0; i < ahci_port_count; i++) blkdev_register(&ahci_ports[i].dev);
+
+    kprint("AHCI: "); kprint_dec(ahci_port_count); kprint(" SATA disk(s), ");
+    kprint_dec(ahci_slots); kprint(" command slots");
+    kprint(irq ? "\n" : ", polled\n");
+}
+
+void ahci_print_drives(void) {
+    for(u32 i = 0; i < ahci_port_count; i++) {
+        ahci_port_t* port = &ahci_ports[i];
+
+        kprint(port->dev.name); kprint(": "); kprint(port->model); kprint("\n");
+        kprint("  Capacity: "); kprint_dec((u32)(port->total_sectors >> 11)); kprint(" MB");
+        kprint(", AHCI port "); kprint_dec(port->index);
+        if(port->ncq) {
+            kprint(", NCQ depth "); kprint_dec(port->dev.max_inflight); kprint("\n");
+        } else {
+            kprint(", no NCQ\n");
+        }
+    }
+}
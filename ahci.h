@@ -0,0 +1,36 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: ahci.h
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Header file for the AHCI (SATA) driver.
+    Dependencies: types.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#pragma once
+#include "types.h"
+
+#define AHCI_MAX_PORTS 2     // SATA disks we drive at most
+#define AHCI_MAX_SLOTS 32    // Command slots (and NCQ tags) per port
+
+void ahci_init(void);
+void ahci_print_drives(void);
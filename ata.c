@@ -19,7 +19,7 @@
     Created on: August 10th 2025
     Created by: jjones (GitHub Username: KlondikeDev)
     Purpose: To setup ATA disk drivers.
-    Dependencies: types.h, vga.h, idt.h, kutils.h
+    Dependencies: types.h, vga.h, idt.h, kutils.h, ata.h, pci.h, blkq.h
 
     Suggested Changes/Todo:
     Nothing to do.
@@ -36,53 +36,141 @@
 #include "vga.h"
 #include "idt.h"
 #include "kutils.h"
+#include "ata.h"
+#include "pci.h"
+#include "blkq.h"
+// ATA commands
+#define ATA_CMD_READ_SECTORS    0x20
+#define ATA_CMD_WRITE_SECTORS   0x30
+#define ATA_CMD_READ_DMA        0xC8
+#define ATA_CMD_WRITE_DMA       0xCA
+#define ATA_CMD_READ_MULTIPLE   0xC4
+#define ATA_CMD_WRITE_MULTIPLE  0xC5
+#define ATA_CMD_SET_MULTIPLE    0xC6
+#define ATA_CMD_FLUSH_CACHE     0xE7
+#define ATA_CMD_IDENTIFY        0xEC
 
-u16 identify_data[256];
+// LBA48 ("EXT") versions of the above
+#define ATA_CMD_READ_SECTORS_EXT   0x24
+#define ATA_CMD_READ_DMA_EXT       0x25
+#define ATA_CMD_READ_MULTIPLE_EXT  0x29
+#define ATA_CMD_WRITE_SECTORS_EXT  0x34
+#define ATA_CMD_WRITE_DMA_EXT      0x35
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_FLUSH_CACHE_EXT    0xEA
 
+#define ATA_LBA28_LIMIT 0x10000000ULL  // First sector LBA28 commands can't reach (128 GiB)
+
+#define ATA_TIMEOUT_TICKS (5 * TIMER_HZ)  // Give up on a drive after 5 seconds
+
+// Task file registers, as offsets from a channel's I/O base
+#define ATA_REG_DATA     0
+#define ATA_REG_ERROR    1
+#define ATA_REG_COUNT    2
+#define ATA_REG_LBA_LO   3
+#define ATA_REG_LBA_MID  4
+#define ATA_REG_LBA_HI   5
+#define ATA_REG_DEVICE   6
+#define ATA_REG_STATUS   7  // Reads as status, writes as command
+#define ATA_REG_COMMAND  7
+
+// Bus-master IDE registers (offsets from a channel's bus-master base)
+#define ATA_BM_COMMAND    0x00
+#define ATA_BM_STATUS     0x02
+#define ATA_BM_PRD_TABLE  0x04
+#define ATA_BM_CMD_START  0x01
+#define ATA_BM_CMD_READ   0x08  // Direction: device to memory
+
+// Physical region descriptor. The table must not cross a 64KB boundary, which
+// aligning it to its own size guarantees.
 typedef struct {
-    char name[32];        // Filename (null-terminated)
-    u32 size;            // File size in bytes
-    u32 start_block;     // First block of file data
-    u32 block_count;     // How many blocks this file uses
-    u8 used;             // 1 if entry is used, 0 if free
-    u8 reserved[3];      // Padding to align to 48 bytes
-} klfs_file_entry_t;
+    u32 phys_addr;
+    u16 byte_count;
+    u16 flags;
+} PACKED ata_prd_t;
+
+#define ATA_PRD_EOT     0x8000  // Last entry in the table
+#define ATA_PRD_ENTRIES 64      // Room for a merged command built from many small buffers
 
-#define KLFS_MAGIC 0x4B4C4653
-#define MAX_FILES 20  // Fits in 1KB block with room for superblock
+#define ATA_CHANNELS 2
+#define ATA_DRIVES   4  // Master and slave on each channel
 
+// One IDE channel. Master and slave share its registers, so only one of them
+// can have a command running at a time, but the two channels work independently.
 typedef struct {
-    u32 magic;                           // 0x4B4C4653
-    u32 total_blocks;                    // Total blocks on disk
-    u32 free_blocks;                     // Free blocks available
-    u32 file_count;                      // Number of files
-    u8 reserved[48];                     // Reserved space
-    klfs_file_entry_t files[MAX_FILES];  // File entries (20 * 48 = 960 bytes)
-} klfs_superblock_t;
-
-bool check_status(void);
-void extract_drive_info(void);
-
-bool identify_drive(u8 drive_select){
-    outb(0x1F6, drive_select);
-    outb(0x1F2, 0);
-    outb(0x1F3, 0);
-    outb(0x1F4, 0);
-    outb(0x1F5, 0);
-    outb(0x1F7, 0xEC);
-    
-    if(check_status()) {  // Only read data if status check passes
-        for(int i = 0; i < 256; i++) {
-            identify_data[i] = inw(0x1F0);
-        }
-        kprint("IDENTIFY data read successfully\n");
-        return true;
-    }
-    return false;  // Add this line
+    u16 io_base;             // Task file registers
+    u16 ctrl_base;           // Alternate status / device control
+    u16 bm_base;             // Bus-master registers, 0 when DMA isn't available
+    u8 irq;
+    volatile bool irq_fired; // Set by the channel's IRQ once a DRQ block or command is done
+    volatile u8 irq_status;
+    ata_prd_t* prd_table;
+    blk_cmd_t* active;       // DMA command in flight, 0 when the channel is idle
+    struct ata_drive* active_drive;
+    bool pio32;              // Controller decodes 32-bit accesses to the data port
+} ata_channel_t;
+
+// PIO transfer kernels move whole sectors through the data port
+typedef void (*ata_pio_in_t)(u16 port, void* buffer, u32 sectors);
+typedef void (*ata_pio_out_t)(u16 port, const void* buffer, u32 sectors);
+
+typedef struct ata_drive {
+    ata_channel_t* channel;
+    u8 slave;                // 0 = master, 1 = slave
+    bool present;
+    bool lba48;              // Supports 48-bit addressing
+    bool dma;                // Use bus-master DMA for this drive
+    u32 multiple_count;      // Sectors per DRQ block, set by SET MULTIPLE MODE
+    bool pio32;              // Data port is read and written a doubleword at a time
+    ata_pio_in_t pio_in;
+    ata_pio_out_t pio_out;
+    u64 total_sectors;       // Capacity from IDENTIFY
+    char model[41];
+    char serial[21];
+    blkdev_t dev;
+} ata_drive_t;
+
+static ata_prd_t ata_prd_tables[ATA_CHANNELS][ATA_PRD_ENTRIES] __attribute__((aligned(512)));
+static ata_channel_t ata_channels[ATA_CHANNELS];
+static ata_drive_t ata_drives[ATA_DRIVES];  // hda, hdb (primary), hdc, hdd (secondary)
+
+u16 identify_data[256];  // Scratch space for the last IDENTIFY
+
+static void ata_set_multiple_mode(ata_drive_t* drive);
+static bool ata_wait_irq(ata_channel_t* ch);
+
+// PIO helpers
+// Reading the alternate status port takes ~100ns, so four reads give the drive
+// the 400ns it needs before the main status register is valid again.
+static void ata_delay400(ata_channel_t* ch) {
+    for(int i = 0; i < 4; i++) inb(ch->ctrl_base);
+}
+
+static void ata_report_timeout(ata_channel_t* ch) {
+    kprint("Error: ATA command timed out (status ");
+    kprint_hex(inb(ch->ctrl_base));
+    kprint(")\n");
+}
+
+static void ata_report_error(ata_channel_t* ch, u8 status) {
+    kprint("Error: ATA command failed (status ");
+    kprint_hex(status);
+    kprint(", error ");
+    kprint_hex(inb(ch->io_base + ATA_REG_ERROR));
+    kprint(")\n");
+}
+
+// Point the channel at the master or slave. The other drive may have been
+// selected last, so give the new one time to drive the status register.
+static void ata_select(ata_drive_t* drive, u8 device) {
+    ata_channel_t* ch = drive->channel;
+    outb(ch->io_base + ATA_REG_DEVICE, device | (drive->slave << 4));
+    ata_delay400(ch);
 }
 
-bool check_status(){  // Return bool instead of void
-    u8 status = inb(0x1F7);
+static bool check_status(ata_channel_t* ch){  // Return bool instead of void
+    u8 status = inb(ch->io_base + ATA_REG_STATUS);
+    u32 start = timer_ticks;
     
     if(status == 0){
         kprint("DRIVE NOT FOUND.\n");
@@ -90,7 +178,17 @@ bool check_status(){  // Return bool instead of void
     }
     
     while(status & 0x80){
-        status = inb(0x1F7);
+        if(timer_ticks - start > ATA_TIMEOUT_TICKS) {
+            kprint("DRIVE TIMEOUT.\n");
+            return false;
+        }
+        status = inb(ch->io_base + ATA_REG_STATUS);
+    }
+
+    // ATAPI devices (CD-ROMs) abort IDENTIFY and leave their signature behind
+    if(inb(ch->io_base + ATA_REG_LBA_MID) || inb(ch->io_base + ATA_REG_LBA_HI)) {
+        kprint("NOT AN ATA DISK.\n");
+        return false;
     }
     
     if(status & 0x01){
@@ -99,537 +197,585 @@ bool check_status(){  // Return bool instead of void
     }
     
     while(!(status & 0x08)) {
-        status = inb(0x1F7);
+        if(timer_ticks - start > ATA_TIMEOUT_TICKS) {
+            kprint("DRIVE TIMEOUT.\n");
+            return false;
+        }
+        status = inb(ch->io_base + ATA_REG_STATUS);
     }
     
     kprint("DRIVE READY\n");
     return true;  // Return true on success
 }
 
-void extract_drive_info() {
-    char model[41] = {0};  // 40 chars + null terminator
-    char serial[21] = {0}; // 20 chars + null terminator
-    
-    // Extract model name (words 27-46, byte-swapped)
-    for(int i = 0; i < 20; i++) {
-        u16 word = identify_data[27 + i];
-        model[i * 2] = (word >> 8) & 0xFF;      // High byte first
-        model[i * 2 + 1] = word & 0xFF;         // Then low byte
-    }
-    
-    // Extract serial number (words 10-19, byte-swapped)  
-    for(int i = 0; i < 10; i++) {
-        u16 word = identify_data[10 + i];
-        serial[i * 2] = (word >> 8) & 0xFF;
-        serial[i * 2 + 1] = word & 0xFF;
-    }
-    
-    // Extract capacity (words 60-61, little-endian 32-bit)
-    u32 total_sectors = identify_data[60] | (identify_data[61] << 16);
-    u32 capacity_mb = (total_sectors * 512) / (1024 * 1024);
-    
-    kprint("Model: "); kprint(model); kprint("\n");
-    kprint("Serial: "); kprint(serial); kprint("\n");
-    kprint("Capacity: "); kprint_dec(capacity_mb); kprint(" MB\n");
-}
+static bool identify_drive(ata_drive_t* drive){
+    ata_channel_t* ch = drive->channel;
 
-void detect_drives() {
-    // Primary Master (current)
-    kprint("Checking Primary Master...\n");
-    if(identify_drive(0xA0)) {
-        kprint("Primary Master found\n");
-    }
-    
-    // Primary Slave  
-    kprint("Checking Primary Slave...\n");
-    if(identify_drive(0xB0)) {
-        kprint("Primary Slave found\n");
+    if(inb(ch->io_base + ATA_REG_STATUS) == 0xFF) {  // Floating bus, nothing attached
+        kprint("DRIVE NOT FOUND.\n");
+        return false;
     }
-}
 
-// Basic sector I/O
-bool read_sector(u32 lba, void* buffer) {
-    // Wait for drive ready
-    while(inb(0x1F7) & 0x80);
-    
-    // Set up LBA address  
-    outb(0x1F6, 0xE0 | ((lba >> 24) & 0x0F));  // LBA mode + drive 0
-    outb(0x1F2, 1);                             // Sector count
-    outb(0x1F3, lba & 0xFF);                    // LBA[7:0]
-    outb(0x1F4, (lba >> 8) & 0xFF);             // LBA[15:8] 
-    outb(0x1F5, (lba >> 16) & 0xFF);            // LBA[23:16]
-    
-    // Send READ command
-    outb(0x1F7, 0x20);
-    
-    // Wait for DRQ
-    while(!(inb(0x1F7) & 0x08));
-    
-    // Read 256 words (512 bytes)
-    u16* data = (u16*)buffer;
-    for(int i = 0; i < 256; i++) {
-        data[i] = inw(0x1F0);
+    ata_select(drive, 0xA0);
+    outb(ch->io_base + ATA_REG_COUNT, 0);
+    outb(ch->io_base + ATA_REG_LBA_LO, 0);
+    outb(ch->io_base + ATA_REG_LBA_MID, 0);
+    outb(ch->io_base + ATA_REG_LBA_HI, 0);
+    outb(ch->io_base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay400(ch);
+    
+    if(check_status(ch)) {  // Only read data if status check passes
+        insw(ch->io_base + ATA_REG_DATA, identify_data, 256);
+        kprint("IDENTIFY data read successfully\n");
+        return true;
     }
-    return true;
+    return false;
 }
 
-bool write_sector(u32 lba, void* buffer) {
-    // Wait for drive ready
-    while(inb(0x1F7) & 0x80);
-    
-    // Set up LBA address
-    outb(0x1F6, 0xE0 | ((lba >> 24) & 0x0F));
-    outb(0x1F2, 1);
-    outb(0x1F3, lba & 0xFF);
-    outb(0x1F4, (lba >> 8) & 0xFF);
-    outb(0x1F5, (lba >> 16) & 0xFF);
-    
-    // Send WRITE command
-    outb(0x1F7, 0x30);
-    
-    // Wait for DRQ
-    while(!(inb(0x1F7) & 0x08));
-    
-    // Write 256 words (512 bytes)
-    u16* data = (u16*)buffer;
-    for(int i = 0; i < 256; i++) {
-        outw(0x1F0, data[i]);
+// Sector count from a block of IDENTIFY data. Shared with the AHCI driver.
+u64 ata_identify_sectors(const u16* id) {
+    if(id[83] & (1 << 10)) {  // LBA48 supported
+        return (u64)id[100] | ((u64)id[101] << 16) |
+               ((u64)id[102] << 32) | ((u64)id[103] << 48);
     }
-    return true;
+    return (u32)id[60] | ((u32)id[61] << 16);
 }
 
-// KLFS block I/O (1KB = 2 sectors)
-bool read_block(u32 block_num, void* buffer) {
-    u32 sector = block_num * 2;
-    if(!read_sector(sector, buffer)) return false;
-    if(!read_sector(sector + 1, (u8*)buffer + 512)) return false;
-    return true;
+// IDENTIFY strings are byte-swapped and padded with spaces
+void ata_identify_string(const u16* id, char* out, u32 first_word, u32 words) {
+    for(u32 i = 0; i < words; i++) {
+        u16 word = id[first_word + i];
+        out[i * 2] = (word >> 8) & 0xFF;      // High byte first
+        out[i * 2 + 1] = word & 0xFF;         // Then low byte
+    }
+    u32 len = words * 2;
+    while(len > 0 && out[len - 1] == ' ') len--;
+    out[len] = '\0';
 }
 
-bool write_block(u32 block_num, void* buffer) {
-    u32 sector = block_num * 2;
-    if(!write_sector(sector, buffer)) return false;
-    if(!write_sector(sector + 1, (u8*)buffer + 512)) return false;
-    return true;
-}
+// Called from irq_handler for IRQ 14/15. Reading the status register acknowledges the drive.
+void ata_irq_handler(u8 irq) {
+    ata_channel_t* ch = (irq == 14) ? &ata_channels[0] : &ata_channels[1];
 
-// Simple KLFS format
-// KLFS format with proper magic number
-void klfs_format() {
-    klfs_superblock_t sb = {0};
-    
-    sb.magic = KLFS_MAGIC;
-    sb.total_blocks = 200;    // Adjust based on your disk size
-    sb.free_blocks = 199;     // All blocks free except superblock
-    sb.file_count = 0;
-    
-    write_block(0, &sb);
-    kprint("KLFS formatted with directory structure!\n");
-}
-void klfs_verify() {
-    u8 block[1024];
-    
-    if(read_block(0, block)) {
-        u32 magic = *(u32*)block;
-        if(magic == 0x4B4C4653) {
-            kprint("KLFS filesystem detected! Magic: ");
-            kprint_hex(magic >> 24); kprint_hex(magic >> 16); 
-            kprint_hex(magic >> 8); kprint_hex(magic & 0xFF);
-            kprint("\n");
-        } else {
-            kprint("No KLFS filesystem found. Magic: ");
-            kprint_hex(magic >> 24); kprint_hex(magic >> 16);
-            kprint_hex(magic >> 8); kprint_hex(magic & 0xFF);
-            kprint("\n");
-        }
-    } else {
-        kprint("Failed to read block 0\n");
-    }
+    ch->irq_status = inb(ch->io_base + ATA_REG_STATUS);
+    ch->irq_fired = true;
+    blkq_notify();
 }
 
-void klfs_list_files() {
-    klfs_superblock_t sb;
-    
-    if(!read_block(0, &sb)) {
-        kprint("Error: Failed to read superblock\n");
-        return;
-    }
-    
-    if(sb.magic != KLFS_MAGIC) {
-        kprint("Error: Not a KLFS filesystem\n");
-        return;
-    }
-    
-    kprint("Files in KLFS:\n");
-    kprint("Name                Size     Blocks\n");
-    kprint("--------------------------------\n");
-    
-    if(sb.file_count == 0) {
-        kprint("(no files)\n");
-        return;
-    }
-    
-    for(u32 i = 0; i < MAX_FILES; i++) {
-        if(sb.files[i].used) {
-            // Print filename, truncated to 19 chars if needed
-            u32 name_len = 0;
-            while(sb.files[i].name[name_len] && name_len < 32) name_len++;
-            
-            if(name_len > 19) {
-                // Print first 16 chars + "..."
-                for(u32 j = 0; j < 16; j++) {
-                    char str[2] = {sb.files[i].name[j], '\0'};
-                    kprint(str);
-                }
-                kprint("...");
-                name_len = 19;
-            } else {
-                kprint(sb.files[i].name);
-            }
-            
-            // Pad to 20 characters total
-            for(u32 j = name_len; j < 20; j++) kprint(" ");
-            
-            kprint_dec(sb.files[i].size);
-            kprint("      ");
-            kprint_dec(sb.files[i].block_count);
-            kprint("\n");
+// Sleep until the channel's IRQ reports the end of a DRQ block or command. The
+// CPU halts between interrupts, so the keyboard, the timer and the other
+// channel keep running while the drive works.
+static bool ata_wait_irq(ata_channel_t* ch) {
+    u32 start = timer_ticks;
+
+    for(;;) {
+        __asm__ volatile ("cli");
+        if(ch->irq_fired) {
+            ch->irq_fired = false;
+            __asm__ volatile ("sti");
+            break;
+        }
+        if(timer_ticks - start > ATA_TIMEOUT_TICKS) {
+            __asm__ volatile ("sti");
+            ata_report_timeout(ch);
+            return false;
         }
+        __asm__ volatile ("sti; hlt");  // sti takes effect after hlt, so no wakeup is lost
     }
-    
-    kprint("\nTotal files: ");
-    kprint_dec(sb.file_count);
-    kprint(", Free blocks: ");
-    kprint_dec(sb.free_blocks);
-    kprint("\n");
-}
 
-bool klfs_create_file(const char* filename) {
-    klfs_superblock_t sb;
-    
-    if(!read_block(0, &sb)) {
-        kprint("Error: Failed to read superblock\n");
-        return false;
-    }
-    
-    if(sb.magic != KLFS_MAGIC) {
-        kprint("Error: Not a KLFS filesystem\n");
+    if(ch->irq_status & 0x21) {  // ERR or DF set
+        ata_report_error(ch, ch->irq_status);
         return false;
     }
-    
-    // Check if file already exists
-    for(u32 i = 0; i < MAX_FILES; i++) {
-        if(sb.files[i].used && str_equals(sb.files[i].name, filename)) {
-            kprint("Error: File already exists\n");
+    return true;
+}
+
+// Wait for BSY to clear, then for DRQ. Returns false on ERR/DF or timeout instead of hanging.
+static bool ata_wait_drq(ata_channel_t* ch) {
+    u32 start = timer_ticks;
+    u8 status = inb(ch->io_base + ATA_REG_STATUS);
+
+    while((status & 0x80) || !(status & 0x08)) {
+        if(!(status & 0x80) && (status & 0x21)) {  // ERR or DF set
+            ata_report_error(ch, status);
             return false;
         }
-    }
-    
-    // Find free entry
-    for(u32 i = 0; i < MAX_FILES; i++) {
-        if(!sb.files[i].used) {
-            // Copy filename (safely)
-            u32 j;
-            for(j = 0; j < 31 && filename[j]; j++) {
-                sb.files[i].name[j] = filename[j];
-            }
-            sb.files[i].name[j] = '\0';
-            
-            sb.files[i].size = 0;
-            sb.files[i].start_block = 0;  // No data blocks yet
-            sb.files[i].block_count = 0;
-            sb.files[i].used = 1;
-            
-            sb.file_count++;
-            
-            if(!write_block(0, &sb)) {
-                kprint("Error: Failed to write superblock\n");
-                return false;
-            }
-            
-            kprint("File created: "); kprint(filename); kprint("\n");
-            return true;
+        if(timer_ticks - start > ATA_TIMEOUT_TICKS) {
+            ata_report_timeout(ch);
+            return false;
         }
+        status = inb(ch->io_base + ATA_REG_STATUS);
     }
-    
-    kprint("Error: Directory full\n");
-    return false;
+    return true;
 }
 
-bool klfs_write_file(const char* filename, const char* data) {
-    klfs_superblock_t sb;
-    
-    if(!read_block(0, &sb)) {
-        kprint("Error: Failed to read superblock\n");
-        return false;
-    }
-    
-    // Find the file
-    i32 file_index = -1;
-    for(u32 i = 0; i < MAX_FILES; i++) {
-        if(sb.files[i].used && str_equals(sb.files[i].name, filename)) {
-            file_index = i;
-            break;
-        }
-    }
-    
-    if(file_index == -1) {
-        kprint("Error: File not found\n");
-        return false;
-    }
-    
-    // Calculate data size and blocks needed
-    u32 data_len = 0;
-    while(data[data_len]) data_len++;  // strlen - this is the original size
-    
-    u32 blocks_needed = (data_len + 1023) / 1024;  // Round up to blocks
-    
-    if(blocks_needed > sb.free_blocks) {
-        kprint("Error: Not enough free space\n");
-        return false;
-    }
-    
-    // Find first free block (simple linear search starting after superblock)
-    u32 start_block = 1;
-    
-    // Write data to blocks
-    u32 remaining_data = data_len;  // Use a separate counter variable!
-    for(u32 i = 0; i < blocks_needed; i++) {
-        u8 block_data[1024] = {0};
-        u32 copy_size = (remaining_data > 1024) ? 1024 : remaining_data;
-        
-        for(u32 j = 0; j < copy_size; j++) {
-            block_data[j] = data[j + (i * 1024)];
-        }
-        
-        if(!write_block(start_block + i, block_data)) {
-            kprint("Error: Failed to write data block\n");
+// Wait for BSY to clear before touching the taskfile. A leftover ERR bit from a
+// previous command is fine here since the next command resets it.
+static bool ata_wait_not_busy(ata_channel_t* ch) {
+    u32 start = timer_ticks;
+    u8 status = inb(ch->io_base + ATA_REG_STATUS);
+
+    while(status & 0x80) {
+        if(timer_ticks - start > ATA_TIMEOUT_TICKS) {
+            ata_report_timeout(ch);
             return false;
         }
-        
-        remaining_data -= copy_size;  // Decrement the counter, not the original size
-    }
-    
-    // Update file entry with the original size
-    sb.files[file_index].size = data_len;  // Use original data_len here
-    sb.files[file_index].start_block = start_block;
-    sb.files[file_index].block_count = blocks_needed;
-    sb.free_blocks -= blocks_needed;
-    
-    if(!write_block(0, &sb)) {
-        kprint("Error: Failed to update superblock\n");
-        return false;
+        status = inb(ch->io_base + ATA_REG_STATUS);
     }
-    
-    kprint("File written successfully\n");
     return true;
 }
 
-bool klfs_read_file(const char* filename) {
-    klfs_superblock_t sb;
-    
-    if(!read_block(0, &sb)) {
-        kprint("Error: Failed to read superblock\n");
-        return false;
-    }
-    
-    // Find the file
-    i32 file_index = -1;
-    for(u32 i = 0; i < MAX_FILES; i++) {
-        if(sb.files[i].used && str_equals(sb.files[i].name, filename)) {
-            file_index = i;
-            break;
-        }
+// The LBA48 version of a command
+static u8 ata_ext_command(u8 command) {
+    switch(command) {
+        case ATA_CMD_READ_SECTORS:   return ATA_CMD_READ_SECTORS_EXT;
+        case ATA_CMD_WRITE_SECTORS:  return ATA_CMD_WRITE_SECTORS_EXT;
+        case ATA_CMD_READ_MULTIPLE:  return ATA_CMD_READ_MULTIPLE_EXT;
+        case ATA_CMD_WRITE_MULTIPLE: return ATA_CMD_WRITE_MULTIPLE_EXT;
+        case ATA_CMD_READ_DMA:       return ATA_CMD_READ_DMA_EXT;
+        case ATA_CMD_WRITE_DMA:      return ATA_CMD_WRITE_DMA_EXT;
+        case ATA_CMD_FLUSH_CACHE:    return ATA_CMD_FLUSH_CACHE_EXT;
+        default:                     return command;
     }
-    
-    if(file_index == -1) {
-        kprint("Error: File not found\n");
+}
+
+// Program the drive's taskfile and send the command. Transfers that reach past
+// 128 GiB switch to the LBA48 register protocol and the EXT version of the
+// command; everything else keeps the shorter LBA28 sequence.
+static bool ata_issue(ata_drive_t* drive, u64 lba, u32 count, u8 command) {
+    ata_channel_t* ch = drive->channel;
+    u16 io = ch->io_base;
+    bool lba48 = (lba + count > ATA_LBA28_LIMIT);
+
+    if(lba48 && !drive->lba48) {
+        kprint("Error: Sector is beyond the drive's 28-bit address range\n");
         return false;
     }
-    
-    klfs_file_entry_t* file = &sb.files[file_index];
-    
-    if(file->size == 0) {
-        kprint("(empty file)\n");
-        return true;
+
+    if(lba48) {
+        ata_select(drive, 0x40);                            // LBA mode
+        if(!ata_wait_not_busy(ch)) return false;
+        // High-order bytes go in first, then the low-order bytes on top of them
+        outb(io + ATA_REG_COUNT, (count >> 8) & 0xFF);      // Sector count[15:8]
+        outb(io + ATA_REG_LBA_LO, (lba >> 24) & 0xFF);      // LBA[31:24]
+        outb(io + ATA_REG_LBA_MID, (lba >> 32) & 0xFF);     // LBA[39:32]
+        outb(io + ATA_REG_LBA_HI, (lba >> 40) & 0xFF);      // LBA[47:40]
+        outb(io + ATA_REG_COUNT, count & 0xFF);             // Sector count[7:0]
+        outb(io + ATA_REG_LBA_LO, lba & 0xFF);              // LBA[7:0]
+        outb(io + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);      // LBA[15:8]
+        outb(io + ATA_REG_LBA_HI, (lba >> 16) & 0xFF);      // LBA[23:16]
+        command = ata_ext_command(command);
+    } else {
+        ata_select(drive, 0xE0 | ((lba >> 24) & 0x0F));    // LBA mode + LBA[27:24]
+        if(!ata_wait_not_busy(ch)) return false;
+        outb(io + ATA_REG_COUNT, count & 0xFF);             // Sector count (256 is sent as 0)
+        outb(io + ATA_REG_LBA_LO, lba & 0xFF);              // LBA[7:0]
+        outb(io + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);      // LBA[15:8]
+        outb(io + ATA_REG_LBA_HI, (lba >> 16) & 0xFF);      // LBA[23:16]
+    }
+    ch->irq_fired = false;
+    outb(io + ATA_REG_COMMAND, command);
+    ata_delay400(ch);
+    return true;
+}
+
+// Enable READ/WRITE MULTIPLE using the block size reported in IDENTIFY word 47.
+// Must be called while identify_data still holds this drive's data.
+static void ata_set_multiple_mode(ata_drive_t* drive) {
+    ata_channel_t* ch = drive->channel;
+    u16 max_block = identify_data[47] & 0xFF;
+    drive->multiple_count = 1;
+
+    if(max_block <= 1) return;  // Drive doesn't support multiple mode
+
+    ata_select(drive, 0xE0);
+    outb(ch->io_base + ATA_REG_COUNT, max_block);
+    ch->irq_fired = false;
+    outb(ch->io_base + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+
+    if(ata_wait_irq(ch)) {
+        drive->multiple_count = max_block;
+        kprint("Multiple mode: "); kprint_dec(max_block); kprint(" sectors per interrupt\n");
     }
-    
-    // Read and print each block
-    u32 remaining_size = file->size;
-    for(u32 i = 0; i < file->block_count; i++) {
-        u8 block_data[1024];
-        
-        if(!read_block(file->start_block + i, block_data)) {
-            kprint("Error: Failed to read data block\n");
-            return false;
-        }
-        
-        // Print the data from this block
-        u32 print_size = (remaining_size > 1024) ? 1024 : remaining_size;
-        for(u32 j = 0; j < print_size; j++) {
-            char str[2] = {block_data[j], '\0'};
-            kprint(str);
+}
+
+// PIO transfer kernels. Each port access is a VM exit under emulation, so
+// whole runs of sectors go through one rep insw/outsw, or rep insd/outsd
+// (half as many accesses) on drives that support 32-bit PIO.
+static void ata_pio_in16(u16 port, void* buffer, u32 sectors) {
+    insw(port, buffer, sectors * 256);
+}
+
+static void ata_pio_out16(u16 port, const void* buffer, u32 sectors) {
+    outsw(port, buffer, sectors * 256);
+}
+
+static void ata_pio_in32(u16 port, void* buffer, u32 sectors) {
+    insl(port, buffer, sectors * 128);
+}
+
+static void ata_pio_out32(u16 port, const void* buffer, u32 sectors) {
+    outsl(port, buffer, sectors * 128);
+}
+
+// Walks a segment list for the PIO loops
+typedef struct {
+    blk_segment_t* seg;
+    u32 left;        // Sectors left in the current segment
+    u8* data;
+} ata_cursor_t;
+
+// The next run of sectors that are consecutive in memory, at most max of them
+static u8* ata_next_run(ata_cursor_t* cursor, u32 max, u32* count) {
+    while(cursor->left == 0) {
+        cursor->seg++;
+        cursor->data = (u8*)cursor->seg->buffer;
+        cursor->left = cursor->seg->count;
+    }
+    u32 n = (cursor->left < max) ? cursor->left : max;
+    u8* run = cursor->data;
+    cursor->data += n * 512;
+    cursor->left -= n;
+    *count = n;
+    return run;
+}
+
+// Multi-sector PIO for a single command of up to 256 sectors. With multiple mode
+// enabled the drive hands over multiple_count sectors per DRQ block. The drive
+// raises its channel's IRQ for every block, and the CPU sleeps in ata_wait_irq in between.
+static bool ata_pio_read(ata_drive_t* drive, u64 lba, u32 count, blk_segment_t* segs) {
+    ata_channel_t* ch = drive->channel;
+    u32 per_block = drive->multiple_count;
+    u8 command = (per_block > 1) ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ_SECTORS;
+    ata_cursor_t cursor = { segs, segs[0].count, (u8*)segs[0].buffer };
+
+    if(!ata_issue(drive, lba, count, command)) return false;
+
+    for(u32 left = count; left > 0; ) {
+        u32 n = (left > per_block) ? per_block : left;
+        if(!ata_wait_irq(ch) || !ata_wait_drq(ch)) return false;
+
+        // Read this DRQ block, one string transfer per run of memory
+        for(u32 done = 0; done < n; ) {
+            u32 run;
+            u8* data = ata_next_run(&cursor, n - done, &run);
+            drive->pio_in(ch->io_base + ATA_REG_DATA, data, run);
+            done += run;
         }
-        
-        remaining_size -= print_size;
+        left -= n;
     }
-    
-    kprint("\n");  // Add newline at end
     return true;
 }
 
-bool klfs_delete_file(const char* filename) {
-    klfs_superblock_t sb;
-    
-    if(!read_block(0, &sb)) {
-        kprint("Error: Failed to read superblock\n");
-        return false;
-    }
-    
-    // Find the file
-    i32 file_index = -1;
-    for(u32 i = 0; i < MAX_FILES; i++) {
-        if(sb.files[i].used && str_equals(sb.files[i].name, filename)) {
-            file_index = i;
-            break;
+static bool ata_pio_write(ata_drive_t* drive, u64 lba, u32 count, blk_segment_t* segs) {
+    ata_channel_t* ch = drive->channel;
+    u32 per_block = drive->multiple_count;
+    u8 command = (per_block > 1) ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_WRITE_SECTORS;
+    ata_cursor_t cursor = { segs, segs[0].count, (u8*)segs[0].buffer };
+
+    if(!ata_issue(drive, lba, count, command)) return false;
+
+    for(u32 left = count; left > 0; ) {
+        u32 n = (left > per_block) ? per_block : left;
+        // The first block is requested without an interrupt; later ones
+        // are already pending by the time the previous block's IRQ arrives
+        if(!ata_wait_drq(ch)) return false;
+
+        for(u32 done = 0; done < n; ) {
+            u32 run;
+            const u8* data = ata_next_run(&cursor, n - done, &run);
+            drive->pio_out(ch->io_base + ATA_REG_DATA, data, run);
+            done += run;
         }
+        left -= n;
+
+        // IRQ after every block; the last one means the drive committed the data
+        if(!ata_wait_irq(ch)) return false;
     }
-    
-    if(file_index == -1) {
-        kprint("Error: File not found\n");
-        return false;
+    return true;
+}
+
+static bool ata_pio_transfer(ata_drive_t* drive, blk_cmd_t* cmd) {
+    return cmd->write ? ata_pio_write(drive, cmd->lba, cmd->count, cmd->segs)
+                      : ata_pio_read(drive, cmd->lba, cmd->count, cmd->segs);
+}
+
+// Bus-master DMA
+// The PIIX IDE function has a bus-master register block at BAR4, eight ports
+// per channel. The driver points it at a physical region descriptor (PRD)
+// table that describes where in memory the transfer goes, and the controller
+// moves the data by itself. Each channel has its own engine and PRD table, so
+// both channels can transfer at once.
+static bool ata_dma_init(void) {
+    pci_device_t ide;
+
+    if(!pci_find_class(0x01, 0x01, &ide)) return false;  // Mass storage, IDE
+    if(!(ide.prog_if & 0x80)) return false;              // No bus-mastering support
+
+    u32 bar4 = pci_read_bar(&ide, 4);
+    if(!(bar4 & 0x01)) return false;                     // Expect an I/O space BAR
+
+    pci_enable_bus_master(&ide);
+
+    for(u32 c = 0; c < ATA_CHANNELS; c++) {
+        ata_channel_t* ch = &ata_channels[c];
+        ch->bm_base = (bar4 & 0xFFFC) + c * 8;
+        outb(ch->bm_base + ATA_BM_COMMAND, 0x00);        // Stop any stale transfer
+        outb(ch->bm_base + ATA_BM_STATUS, 0x06);         // Clear error and interrupt bits
     }
-    
-    klfs_file_entry_t* file = &sb.files[file_index];
-    
-    // Free the blocks (add them back to free count)
-    sb.free_blocks += file->block_count;
-    
-    // Clear the directory entry
-    for(u32 i = 0; i < 32; i++) {
-        file->name[i] = 0;
-    }
-    file->size = 0;
-    file->start_block = 0;
-    file->block_count = 0;
-    file->used = 0;
-    
-    // Update file count
-    sb.file_count--;
-    
-    // Write updated superblock
-    if(!write_block(0, &sb)) {
-        kprint("Error: Failed to update superblock\n");
-        return false;
+
+    kprint("Bus-master DMA enabled (PIIX at I/O ");
+    kprint_hex(ata_channels[0].bm_base >> 8); kprint_hex(ata_channels[0].bm_base & 0xFF);
+    kprint(")\n");
+    return true;
+}
+
+// Describe a segment list in the channel's PRD table, one or more regions per
+// segment. Regions may not cross a 64KB boundary, so segments are split there.
+// Returns false if the list can't be described (odd address or too many
+// regions), in which case the caller falls back to PIO.
+static bool ata_dma_build_prd(ata_channel_t* ch, blk_segment_t* segs, u32 nsegs) {
+    u32 n = 0;
+
+    for(u32 s = 0; s < nsegs; s++) {
+        u32 addr = (u32)segs[s].buffer;
+        u32 bytes = segs[s].count * 512;
+
+        if(addr & 1) return false;
+
+        while(bytes > 0) {
+            if(n == ATA_PRD_ENTRIES) return false;
+            u32 to_boundary = 0x10000 - (addr & 0xFFFF);
+            u32 len = (bytes < to_boundary) ? bytes : to_boundary;
+
+            ch->prd_table[n].phys_addr = addr;
+            ch->prd_table[n].byte_count = len & 0xFFFF;  // 0 means 64KB
+            ch->prd_table[n].flags = 0;
+            addr += len;
+            bytes -= len;
+            n++;
+        }
     }
-    
-    kprint("File deleted: "); kprint(filename); kprint("\n");
+    ch->prd_table[n - 1].flags = ATA_PRD_EOT;
     return true;
 }
 
-bool klfs_copy_file(const char* source, const char* dest) {
-    klfs_superblock_t sb;
-    
-    if(!read_block(0, &sb)) {
-        kprint("Error: Failed to read superblock\n");
+// Start one READ/WRITE DMA command using the PRD table built by
+// ata_dma_build_prd, and return without waiting. The channel's IRQ marks
+// completion and ata_blk_poll picks it up from the block queue.
+static bool ata_dma_start(ata_drive_t* drive, blk_cmd_t* cmd) {
+    ata_channel_t* ch = drive->channel;
+    u8 direction = cmd->write ? 0x00 : ATA_BM_CMD_READ;  // READ means the controller writes memory
+
+    outl(ch->bm_base + ATA_BM_PRD_TABLE, (u32)ch->prd_table);
+    outb(ch->bm_base + ATA_BM_COMMAND, direction);
+    outb(ch->bm_base + ATA_BM_STATUS, 0x06);
+
+    if(!ata_issue(drive, cmd->lba, cmd->count, cmd->write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA)) return false;
+    outb(ch->bm_base + ATA_BM_COMMAND, direction | ATA_BM_CMD_START);
+
+    ch->active = cmd;
+    ch->active_drive = drive;
+    return true;
+}
+
+// Stop the engine after the IRQ (or a timeout) and check how the transfer went
+static bool ata_dma_finish(ata_channel_t* ch, bool irq_ok) {
+    u8 direction = inb(ch->bm_base + ATA_BM_COMMAND) & ATA_BM_CMD_READ;
+    outb(ch->bm_base + ATA_BM_COMMAND, direction);  // Stop the engine
+    u8 bm_status = inb(ch->bm_base + ATA_BM_STATUS);
+    outb(ch->bm_base + ATA_BM_STATUS, 0x06);
+
+    ch->active = 0;
+    ch->active_drive = 0;
+
+    if(irq_ok && (ch->irq_status & 0x21)) {  // ERR or DF set
+        ata_report_error(ch, ch->irq_status);
         return false;
     }
-    
-    // Find source file
-    i32 source_index = -1;
-    for(u32 i = 0; i < MAX_FILES; i++) {
-        if(sb.files[i].used && str_equals(sb.files[i].name, source)) {
-            source_index = i;
-            break;
-        }
-    }
-    
-    if(source_index == -1) {
-        kprint("Error: Source file not found\n");
+    if(bm_status & 0x02) {
+        kprint("Error: DMA transfer failed\n");
         return false;
     }
-    
-    // Create destination file
-    if(!klfs_create_file(dest)) {
-        return false;  // Error message already printed
+    return irq_ok;
+}
+
+// Block device operations. The queue hands each drive one merged command at a
+// time. DMA commands run in the background; PIO ones finish before start
+// returns. A failed DMA transfer turns DMA off for the drive and is retried with PIO.
+static bool ata_blk_start(blkdev_t* dev, blk_cmd_t* cmd) {
+    ata_drive_t* drive = (ata_drive_t*)dev->driver;
+    ata_channel_t* ch = drive->channel;
+
+    if(ch->active) return false;  // The other drive on this channel is transferring
+    if(!drive->present) {
+        blkq_complete(cmd, false);
+        return true;
     }
-    
-    klfs_file_entry_t* source_file = &sb.files[source_index];
-    
-    if(source_file->size == 0) {
-        kprint("Empty file copied\n");
+
+    if(drive->dma && ata_dma_build_prd(ch, cmd->segs, cmd->nsegs)) {
+        if(!ata_dma_start(drive, cmd)) blkq_complete(cmd, false);
         return true;
     }
-    
-    // Read source data into memory
-    u8* file_data = (u8*)0x100000;  // Use memory at 1MB mark
-    u32 remaining_size = source_file->size;
-    
-    for(u32 i = 0; i < source_file->block_count; i++) {
-        u8 block_data[1024];
-        if(!read_block(source_file->start_block + i, block_data)) {
-            kprint("Error: Failed to read source block\n");
-            return false;
-        }
-        
-        u32 copy_size = (remaining_size > 1024) ? 1024 : remaining_size;
-        for(u32 j = 0; j < copy_size; j++) {
-            file_data[i * 1024 + j] = block_data[j];
-        }
-        remaining_size -= copy_size;
+    blkq_complete(cmd, ata_pio_transfer(drive, cmd));
+    return true;
+}
+
+static void ata_blk_poll(blkdev_t* dev) {
+    ata_drive_t* drive = (ata_drive_t*)dev->driver;
+    ata_channel_t* ch = drive->channel;
+    blk_cmd_t* cmd = ch->active;
+    bool ok;
+
+    if(!cmd || ch->active_drive != drive) return;
+
+    if(ch->irq_fired) {
+        ch->irq_fired = false;
+        ok = ata_dma_finish(ch, true);
+    } else if(timer_ticks - cmd->start_tick > ATA_TIMEOUT_TICKS) {
+        ata_report_timeout(ch);
+        ok = ata_dma_finish(ch, false);
+    } else {
+        return;
     }
-    
-    // Write to destination
-    // Ensure buffer is null-terminated so klfs_write_file (which uses strlen)
-    // measures the correct length and doesn't read past the copied data.
-    file_data[source_file->size] = '\0';
-    if(!klfs_write_file(dest, (char*)file_data)) {
-        return false;
+
+    if(!ok) {
+        kprint("Falling back to PIO\n");
+        drive->dma = false;
+        ok = ata_pio_transfer(drive, cmd);
+    }
+    blkq_complete(cmd, ok);
+}
+
+// Ask the drive to commit its internal write cache to the media
+static bool ata_blk_flush(blkdev_t* dev) {
+    ata_drive_t* drive = (ata_drive_t*)dev->driver;
+
+    if(!drive->present || drive->channel->active) return false;
+    if(!ata_issue(drive, 0, 0, ATA_CMD_FLUSH_CACHE)) return false;
+    return ata_wait_irq(drive->channel);
+}
+
+// Read IDENTIFY from one drive and set it up: capacity, addressing, multiple mode
+static bool ata_probe(ata_drive_t* drive) {
+    drive->present = false;
+    drive->lba48 = false;
+    drive->dma = false;
+    drive->multiple_count = 1;  // Plain single-sector PIO until the drive says otherwise
+    drive->pio32 = false;
+    drive->pio_in = ata_pio_in16;
+    drive->pio_out = ata_pio_out16;
+    drive->total_sectors = 0;
+
+    if(!identify_drive(drive)) return false;
+
+    drive->present = true;
+    drive->total_sectors = ata_identify_sectors(identify_data);
+    drive->lba48 = (identify_data[83] & (1 << 10)) != 0;
+    drive->dma = (identify_data[49] & 0x100) != 0;  // Bus-master DMA, if the controller has it
+    ata_identify_string(identify_data, drive->model, 27, 20);
+    ata_identify_string(identify_data, drive->serial, 10, 10);
+    ata_set_multiple_mode(drive);
+
+    // Data port width is up to the host adapter, not the drive: the drive
+    // only ever sees 16-bit transfers on its side of the cable
+    if(drive->channel->pio32) {
+        drive->pio32 = true;
+        drive->pio_in = ata_pio_in32;
+        drive->pio_out = ata_pio_out32;
     }
-    
-    kprint("File copied successfully\n");
     return true;
 }
 
-void klfs_find_file(const char* pattern) {
-    klfs_superblock_t sb;
-    
-    if(!read_block(0, &sb)) {
-        kprint("Error: Failed to read superblock\n");
-        return;
+void detect_drives() {
+    static const char* labels[ATA_DRIVES] = {
+        "Primary Master", "Primary Slave", "Secondary Master", "Secondary Slave"
+    };
+    static const u16 io_bases[ATA_CHANNELS] = { 0x1F0, 0x170 };
+    static const u16 ctrl_bases[ATA_CHANNELS] = { 0x3F6, 0x376 };
+
+    blkq_run();  // Nothing may be in flight while the channels are reset
+
+    // A PCI IDE function has to accept 32-bit reads and writes of the data
+    // port (the PCI IDE spec requires it). An ISA controller might not.
+    pci_device_t ide;
+    bool pci_ide = pci_find_class(0x01, 0x01, &ide);
+
+    for(u32 c = 0; c < ATA_CHANNELS; c++) {
+        ata_channel_t* ch = &ata_channels[c];
+        ch->io_base = io_bases[c];
+        ch->ctrl_base = ctrl_bases[c];
+        ch->bm_base = 0;  // No DMA until the controller is found
+        ch->irq = 14 + c;
+        ch->irq_fired = false;
+        ch->prd_table = ata_prd_tables[c];
+        ch->active = 0;
+        ch->active_drive = 0;
+        ch->pio32 = pci_ide;
+        outb(ch->ctrl_base, 0x00);  // Clear nIEN so the drives raise the channel's IRQ
     }
-    
+
     bool found = false;
-    
-    for(u32 i = 0; i < MAX_FILES; i++) {
-        if(sb.files[i].used) {
-            // Check if pattern matches filename (simple substring search)
-            const char* filename = sb.files[i].name;
-            bool matches = false;
-            
-            // Simple substring search
-            for(u32 j = 0; filename[j]; j++) {
-                bool match = true;
-                for(u32 k = 0; pattern[k]; k++) {
-                    if(filename[j + k] != pattern[k]) {
-                        match = false;
-                        break;
-                    }
-                }
-                if(match) {
-                    matches = true;
-                    break;
-                }
-            }
-            
-            if(matches) {
-                kprint(filename); kprint("\n");
-                found = true;
-            }
+    for(u32 d = 0; d < ATA_DRIVES; d++) {
+        ata_drive_t* drive = &ata_drives[d];
+        drive->channel = &ata_channels[d / 2];
+        drive->slave = d % 2;
+
+        kprint("Checking "); kprint(labels[d]); kprint("...\n");
+        if(ata_probe(drive)) {
+            kprint(labels[d]); kprint(" found\n");
+            found = true;
         }
     }
-    
-    if(!found) {
-        kprint("No files found matching: "); kprint(pattern); kprint("\n");
+
+    if(found) ata_dma_init();
+
+    for(u32 d = 0; d < ATA_DRIVES; d++) {
+        ata_drive_t* drive = &ata_drives[d];
+        if(!drive->present) continue;
+        if(!drive->channel->bm_base) drive->dma = false;
+
+        blkdev_t* dev = &drive->dev;
+        dev->name[0] = 'h';
+        dev->name[1] = 'd';
+        dev->name[2] = 'a' + d;
+        dev->name[3] = '\0';
+        dev->sectors = drive->total_sectors;
+        dev->max_inflight = 1;  // The channel serializes master and slave anyway
+        dev->polled = false;
+        dev->start = ata_blk_start;
+        dev->kick = 0;
+        dev->poll = ata_blk_poll;
+        dev->flush = ata_blk_flush;
+        dev->driver = drive;
+        blkdev_register(dev);
     }
-}
\ No newline at end of file
+}
+
+void ata_print_drives(void) {
+    bool any = false;
+
+    for(u32 d = 0; d < ATA_DRIVES; d++) {
+        ata_drive_t* drive = &ata_drives[d];
+        if(!drive->present) continue;
+        any = true;
+
+        kprint(drive->dev.name); kprint(": "); kprint(drive->model); kprint("\n");
+        kprint("  Serial: "); kprint(drive->serial); kprint("\n");
+        kprint("  Capacity: "); kprint_dec((u32)(drive->total_sectors >> 11)); kprint(" MB");  // 2048 sectors per MB
+        kprint(drive->lba48 ? ", LBA48" : ", LBA28");
+        kprint(drive->dma ? ", DMA" : "");
+        kprint(drive->pio32 ? ", 32-bit PIO" : ", 16-bit PIO");
+        kprint(", "); kprint_dec(drive->multiple_count); kprint(" sectors per interrupt\n");
+    }
+    if(!any) kprint("No ATA drives found\n");
+}
+
+// Basic sector I/O
+bool read_sector(u64 lba, void* buffer) {
+    return read_sectors(lba, 1, buffer);
+}
+
+bool write_sector(u64 lba, void* buffer) {
+    return write_sectors(lba, 1, buffer);
+}
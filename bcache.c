@@ -0,0 +1,375 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: bcache.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: A write-back block cache that sits between KLFS and the disk.
+    Dependencies: types.h, vga.h, bcache.h, blkq.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+/*
+ * Single-block reads and writes (read_block/write_block) go through the cache.
+ * Writes only mark the cached copy dirty; it reaches the disk when the entry
+ * is evicted or on bcache_sync. The least recently used entry is evicted first.
+ *
+ * Multi-block runs (read_blocks/write_blocks) are file data that is usually
+ * only touched once, so they go straight to the disk in one transfer. They
+ * still honour any cached copies so the two paths never disagree.
+ *
+ * Sequential readers can use bcache_read_ahead instead, which prefetches a
+ * window of upcoming blocks into the cache with one merged request. The
+ * window doubles each time a reader uses up the previous one and halves
+ * when the reader seeks somewhere else.
+ */
+
+#include "types.h"
+#include "vga.h"
+#include "bcache.h"
+#include "blkq.h"
+
+typedef struct {
+    u32 block_num;
+    u32 last_used;   // LRU stamp, higher is more recent
+    bool valid;
+    bool dirty;
+} bcache_entry_t;
+
+static bcache_entry_t bcache_entries[BCACHE_ENTRIES];
+static blk_request_t bcache_requests[BCACHE_ENTRIES];  // Write-back requests for bcache_sync
+// Aligned so a cached block never straddles a 64KB DMA boundary
+static u8 bcache_data[BCACHE_ENTRIES][BCACHE_BLOCK_SIZE] __attribute__((aligned(BCACHE_BLOCK_SIZE)));
+static u32 bcache_clock;
+
+// Counters for the "cachestat" command
+static u32 bcache_hits;
+static u32 bcache_misses;
+static u32 bcache_writebacks;
+
+// Counters for the "rastat" command
+static u32 bcache_ra_hits;        // Sequential reads already in the cache
+static u32 bcache_ra_misses;      // Reads that had to wait for the disk
+static u32 bcache_ra_prefetched;  // Blocks fetched ahead of the reader
+static u32 bcache_ra_windows;     // Prefetch commands issued
+
+static void bcache_copy(void* dest, const void* src, u32 len) {
+    u8* d = (u8*)dest;
+    const u8* s = (const u8*)src;
+    for(u32 i = 0; i < len; i++) d[i] = s[i];
+}
+
+void bcache_init(void) {
+    for(u32 i = 0; i < BCACHE_ENTRIES; i++) {
+        bcache_entries[i].valid = false;
+        bcache_entries[i].dirty = false;
+    }
+    bcache_clock = 0;
+    bcache_hits = 0;
+    bcache_misses = 0;
+    bcache_writebacks = 0;
+    bcache_ra_hits = 0;
+    bcache_ra_misses = 0;
+    bcache_ra_prefetched = 0;
+    bcache_ra_windows = 0;
+}
+
+static bcache_entry_t* bcache_lookup(u32 block_num) {
+    for(u32 i = 0; i < BCACHE_ENTRIES; i++) {
+        if(bcache_entries[i].valid && bcache_entries[i].block_num == block_num) {
+            return &bcache_entries[i];
+        }
+    }
+    return 0;
+}
+
+static u8* bcache_entry_data(bcache_entry_t* entry) {
+    return bcache_data[entry - bcache_entries];
+}
+
+static bool bcache_writeback(bcache_entry_t* entry) {
+    if(!write_sectors((u64)entry->block_num * 2, 2, bcache_entry_data(entry))) return false;
+    entry->dirty = false;
+    bcache_writebacks++;
+    return true;
+}
+
+// Pick an entry to (re)use for block_num: a free one if any, otherwise the
+// least recently used one, written back first if dirty.
+static bcache_entry_t* bcache_evict(void) {
+    bcache_entry_t* victim = &bcache_entries[0];
+
+    for(u32 i = 0; i < BCACHE_ENTRIES; i++) {
+        if(!bcache_entries[i].valid) {
+            victim = &bcache_entries[i];
+            break;
+        }
+        if(bcache_entries[i].last_used < victim->last_used) {
+            victim = &bcache_entries[i];
+        }
+    }
+
+    if(victim->valid && victim->dirty && !bcache_writeback(victim)) {
+        return 0;
+    }
+    victim->valid = false;
+    return victim;
+}
+
+bool bcache_read(u32 block_num, void* buffer) {
+    bcache_entry_t* entry = bcache_lookup(block_num);
+
+    if(entry) {
+        bcache_hits++;
+    } else {
+        bcache_misses++;
+        entry = bcache_evict();
+        if(!entry) return false;
+        if(!read_sectors((u64)block_num * 2, 2, bcache_entry_data(entry))) return false;
+        entry->block_num = block_num;
+        entry->dirty = false;
+        entry->valid = true;
+    }
+
+    entry->last_used = ++bcache_clock;
+    bcache_copy(buffer, bcache_entry_data(entry), BCACHE_BLOCK_SIZE);
+    return true;
+}
+
+bool bcache_write(u32 block_num, const void* buffer) {
+    bcache_entry_t* entry = bcache_lookup(block_num);
+
+    if(!entry) {
+        // The whole block is overwritten, so there's nothing to read first
+        entry = bcache_evict();
+        if(!entry) return false;
+        entry->block_num = block_num;
+        entry->valid = true;
+    }
+
+    bcache_copy(bcache_entry_data(entry), buffer, BCACHE_BLOCK_SIZE);
+    entry->dirty = true;
+    entry->last_used = ++bcache_clock;
+    return true;
+}
+
+// Read a run of blocks. Uncached stretches go to the disk as single
+// multi-sector transfers; cached blocks are copied from the cache.
+bool bcache_read_run(u32 block_num, u32 count, void* buffer) {
+    u8* out = (u8*)buffer;
+    u32 i = 0;
+
+    while(i < count) {
+        bcache_entry_t* entry = bcache_lookup(block_num + i);
+        if(entry) {
+            bcache_hits++;
+            bcache_copy(out + i * BCACHE_BLOCK_SIZE, bcache_entry_data(entry), BCACHE_BLOCK_SIZE);
+            i++;
+            continue;
+        }
+
+        u32 run = 1;
+        while(i + run < count && !bcache_lookup(block_num + i + run)) run++;
+
+        bcache_misses += run;
+        if(!read_sectors((u64)(block_num + i) * 2, run * 2, out + i * BCACHE_BLOCK_SIZE)) return false;
+        i += run;
+    }
+    return true;
+}
+
+// Write a run of blocks straight to the disk. Cached copies are refreshed
+// and marked clean since the disk now holds the same data.
+bool bcache_write_run(u32 block_num, u32 count, const void* buffer) {
+    const u8* in = (const u8*)buffer;
+
+    if(!write_sectors((u64)block_num * 2, count * 2, buffer)) return false;
+
+    for(u32 i = 0; i < count; i++) {
+        bcache_entry_t* entry = bcache_lookup(block_num + i);
+        if(entry) {
+            bcache_copy(bcache_entry_data(entry), in + i * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+            entry->dirty = false;
+        }
+    }
+    return true;
+}
+
+static void bcache_sync_done(blk_request_t* req) {
+    bcache_entry_t* entry = (bcache_entry_t*)req->context;
+    if(req->ok) {
+        entry->dirty = false;
+        bcache_writebacks++;
+    }
+}
+
+// Queue every dirty block at once and let the elevator sort and merge them,
+// so neighbouring dirty blocks go out as one command. Then flush the drive's
+// own write cache.
+bool bcache_sync(void) {
+    bool ok = true;
+
+    for(u32 i = 0; i < BCACHE_ENTRIES; i++) {
+        bcache_entry_t* e = &bcache_entries[i];
+        if(!e->valid || !e->dirty) continue;
+
+        blk_request_t* req = &bcache_requests[i];
+        req->dev = 0;  // The root disk, which a disk switch may have changed
+        req->lba = (u64)e->block_num * 2;
+        req->count = 2;
+        req->buffer = bcache_data[i];
+        req->write = true;
+        req->callback = bcache_sync_done;
+        req->context = e;
+        if(!blkq_submit(req)) ok = false;
+    }
+    blkq_run();
+
+    for(u32 i = 0; i < BCACHE_ENTRIES; i++) {
+        if(bcache_entries[i].valid && bcache_entries[i].dirty) ok = false;
+    }
+    return ok && blk_flush();
+}
+
+// Blocks waiting to be written back
+u32 bcache_dirty(void) {
+    u32 dirty = 0;
+    for(u32 i = 0; i < BCACHE_ENTRIES; i++) {
+        if(bcache_entries[i].valid && bcache_entries[i].dirty) dirty++;
+    }
+    return dirty;
+}
+
+void bcache_stats(void) {
+    u32 used = 0, dirty = 0;
+    for(u32 i = 0; i < BCACHE_ENTRIES; i++) {
+        if(bcache_entries[i].valid) used++;
+        if(bcache_entries[i].valid && bcache_entries[i].dirty) dirty++;
+    }
+
+    kprint("Block cache: "); kprint_dec(used); kprint("/"); kprint_dec(BCACHE_ENTRIES);
+    kprint(" blocks in use, "); kprint_dec(dirty); kprint(" dirty\n");
+    kprint("Hits: "); kprint_dec(bcache_hits);
+    kprint("  Misses: "); kprint_dec(bcache_misses);
+    kprint("  Write-backs: "); kprint_dec(bcache_writebacks);
+    kprint("\n");
+}
+
+// Read-ahead
+static blk_request_t bcache_ra_requests[BCACHE_RA_MAX];
+
+static void bcache_ra_done(blk_request_t* req) {
+    bcache_entry_t* entry = (bcache_entry_t*)req->context;
+    if(!req->ok) entry->valid = false;  // Don't leave half-read data behind
+}
+
+// Pull blocks [block_num, block_num + count) into the cache. Each missing block
+// gets its own cache entry and request; the queue merges them into one command.
+static void bcache_prefetch(u32 block_num, u32 count) {
+    u32 n = 0;
+
+    for(u32 i = 0; i < count; i++) {
+        if(bcache_lookup(block_num + i)) continue;
+
+        bcache_entry_t* entry = bcache_evict();
+        if(!entry) break;
+
+        // Claim the entry now so later evictions in this loop pass over it
+        entry->block_num = block_num + i;
+        entry->valid = true;
+        entry->dirty = false;
+        entry->last_used = ++bcache_clock;
+
+        blk_request_t* req = &bcache_ra_requests[n++];
+        req->dev = 0;  // The root disk, which a disk switch may have changed
+        req->lba = (u64)(block_num + i) * 2;
+        req->count = 2;
+        req->buffer = bcache_entry_data(entry);
+        req->write = false;
+        req->callback = bcache_ra_done;
+        req->context = entry;
+        if(!blkq_submit(req)) {
+            // Rejected (past the end of the disk, say): the entry still
+            // holds its old block's data, so it mustn't stay claimed
+            entry->valid = false;
+            n--;
+            break;
+        }
+    }
+
+    if(n > 0) {
+        blkq_run();
+        bcache_ra_prefetched += n;
+        bcache_ra_windows++;
+    }
+}
+
+void bcache_ra_init(bcache_ra_t* ra, u32 first_block) {
+    ra->next_block = first_block;
+    ra->ra_end = first_block;
+    ra->window = BCACHE_RA_MIN;
+    ra->primed = false;
+}
+
+// Read one block for a reader that stops at end_block. A reader that keeps
+// asking for the next block gets ever larger windows prefetched in front of it.
+bool bcache_read_ahead(bcache_ra_t* ra, u32 block_num, u32 end_block, void* buffer) {
+    bool sequential = (block_num == ra->next_block);
+
+    if(!sequential) {
+        // Seek: shrink the window and start a new run from here
+        ra->window /= 2;
+        if(ra->window < BCACHE_RA_MIN) ra->window = BCACHE_RA_MIN;
+        ra->ra_end = block_num;
+        ra->primed = false;
+    }
+
+    if(block_num >= ra->ra_end) {
+        // Ran off the end of what was prefetched: fetch the next window,
+        // bigger than the last one if the reader used all of it
+        if(ra->primed && ra->window < BCACHE_RA_MAX) {
+            ra->window *= 2;
+        }
+        u32 count = ra->window;
+        if(block_num + count > end_block) count = end_block - block_num;
+
+        if(bcache_lookup(block_num)) bcache_ra_hits++;
+        else bcache_ra_misses++;
+
+        bcache_prefetch(block_num, count);
+        ra->ra_end = block_num + count;
+        ra->primed = true;
+    } else if(bcache_lookup(block_num)) {
+        bcache_ra_hits++;
+    } else {
+        bcache_ra_misses++;  // Prefetched but already evicted again
+    }
+
+    ra->next_block = block_num + 1;
+    return bcache_read(block_num, buffer);
+}
+
+void bcache_ra_stats(void) {
+    kprint("Read-ahead: "); kprint_dec(bcache_ra_hits); kprint(" hits, ");
+    kprint_dec(bcache_ra_misses); kprint(" misses\n");
+    kprint("Prefetched "); kprint_dec(bcache_ra_prefetched); kprint(" blocks in ");
+    kprint_dec(bcache_ra_windows); kprint(" requests (window ");
+    kprint_dec(BCACHE_RA_MIN); kprint("-"); kprint_dec(BCACHE_RA_MAX); kprint(" blocks)\n");
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: bcache.h
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Header file for the KLFS block cache.
+    Dependencies: types.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#pragma once
+#include "types.h"
+
+#define BCACHE_BLOCK_SIZE 1024
+#define BCACHE_ENTRIES    64   // 64KB of cached blocks
+
+#define BCACHE_RA_MIN 2     // Smallest read-ahead window, in blocks
+#define BCACHE_RA_MAX 32    // Largest read-ahead window (half the cache)
+
+// Read-ahead state for one sequential reader (one per open file)
+typedef struct {
+    u32 next_block;  // Block a sequential reader would ask for next
+    u32 ra_end;      // One past the last block already prefetched
+    u32 window;      // Blocks fetched by the next prefetch
+    bool primed;     // A window has been fetched since the last seek
+} bcache_ra_t;
+
+void bcache_init(void);
+bool bcache_read(u32 block_num, void* buffer);
+bool bcache_write(u32 block_num, const void* buffer);
+bool bcache_read_run(u32 block_num, u32 count, void* buffer);
+bool bcache_write_run(u32 block_num, u32 count, const void* buffer);
+bool bcache_sync(void);
+u32 bcache_dirty(void);
+void bcache_stats(void);
+void bcache_ra_init(bcache_ra_t* ra, u32 first_block);
+bool bcache_read_ahead(bcache_ra_t* ra, u32 block_num, u32 end_block, void* buffer);
+void bcache_ra_stats(void);
@@ -0,0 +1,430 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: blkq.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Block device registry and the elevator-scheduled request queue in front of the drivers.
+    Dependencies: types.h, kutils.h, vga.h, blkq.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+/*
+ * Each registered device has its own list of pending requests, sorted by LBA.
+ * Requests sit there until the queue runs (blkq_run, or blkq_wait on one of
+ * them). Dispatch follows C-SCAN per device: the head sweeps upwards from
+ * where the last command ended, then wraps back to the lowest pending LBA.
+ * Requests that continue exactly where the previous one ends, in the same
+ * direction, are merged into one multi-sector command with a scatter-gather
+ * segment per request.
+ *
+ * A device takes up to max_inflight commands at once, and every device is
+ * serviced on each pass, so commands on different disks (or channels) are
+ * in flight at the same time. Drivers that finish asynchronously call
+ * blkq_notify from their interrupt handler; the queue sleeps with hlt while
+ * nothing has happened and polls the devices after every interrupt.
+ *
+ * There is no scheduler to run completions in the background, so the queue
+ * is serviced by whoever waits on it. Callbacks run from blkq_run/blkq_wait.
+ */
+
+#include "types.h"
+#include "kutils.h"
+#include "vga.h"
+#include "blkq.h"
+
+static blkdev_t* blkq_devices[BLKQ_MAX_DEVICES];
+static u32 blkq_device_count;
+static blkdev_t* blkq_root;
+
+static blk_cmd_t blkq_commands[BLKQ_MAX_COMMANDS];
+static volatile u32 blkq_events;     // Bumped by driver interrupt handlers
+static u32 blkq_completions;
+
+void blkq_init(void) {
+    blkq_device_count = 0;
+    blkq_root = 0;
+    blkq_events = 0;
+    blkq_completions = 0;
+    for(u32 i = 0; i < BLKQ_MAX_COMMANDS; i++) blkq_commands[i].in_use = false;
+}
+
+// Register a device with the queue. The first one becomes the root device.
+// Registering the same device twice is harmless (drives can be re-probed).
+void blkdev_register(blkdev_t* dev) {
+    for(u32 i = 0; i < blkq_device_count; i++) {
+        if(blkq_devices[i] == dev) return;
+    }
+    if(blkq_device_count >= BLKQ_MAX_DEVICES) return;
+
+    dev->pending = 0;
+    dev->head = 0;
+    dev->inflight = 0;
+    if(dev->max_inflight == 0) dev->max_inflight = 1;
+    blkq_devices[blkq_device_count++] = dev;
+    if(!blkq_root) blkq_root = dev;
+}
+
+u32 blkdev_count(void) {
+    return blkq_device_count;
+}
+
+blkdev_t* blkdev_get(u32 index) {
+    return (index < blkq_device_count) ? blkq_devices[index] : 0;
+}
+
+blkdev_t* blkdev_find(const char* name) {
+    for(u32 i = 0; i < blkq_device_count; i++) {
+        if(str_equals(blkq_devices[i]->name, name)) return blkq_devices[i];
+    }
+    return 0;
+}
+
+blkdev_t* blkdev_root(void) {
+    return blkq_root;
+}
+
+void blkdev_set_root(blkdev_t* dev) {
+    blkq_root = dev;
+}
+
+// Insert into the device's sorted list. New requests go after any others at
+// the same LBA; requests being put back go in front so they keep their order.
+static void blkq_insert(blkdev_t* dev, blk_request_t* req, bool front) {
+    blk_request_t** link = &dev->pending;
+    while(*link && ((*link)->lba < req->lba || (!front && (*link)->lba == req->lba))) {
+        link = &(*link)->next;
+    }
+    req->next = *link;
+    *link = req;
+}
+
+bool blkq_submit(blk_request_t* req) {
+    if(!req->dev) req->dev = blkq_root;
+    if(!req->dev) return false;
+    if(req->count == 0 || req->count > BLKQ_MAX_SECTORS) return false;
+    if(req->lba + req->count > req->dev->sectors) return false;
+
+    req->done = false;
+    req->ok = false;
+    blkq_insert(req->dev, req, false);
+    return true;
+}
+
+// Called by drivers when a command has finished, from the queue's context
+// (start or poll), never from an interrupt handler
+void blkq_complete(blk_cmd_t* cmd, bool ok) {
+    cmd->dev->inflight--;
+    blkq_completions++;
+
+    for(u32 i = 0; i < cmd->nsegs; i++) {
+        blk_request_t* req = cmd->reqs[i];
+        req->ok = ok;
+        req->done = true;
+        if(req->callback) req->callback(req);
+    }
+    cmd->in_use = false;
+}
+
+// Called by drivers from their interrupt handler to wake the queue up
+void blkq_notify(void) {
+    blkq_events++;
+}
+
+static blk_cmd_t* blkq_alloc_command(void) {
+    for(u32 i = 0; i < BLKQ_MAX_COMMANDS; i++) {
+        if(!blkq_commands[i].in_use) {
+            blkq_commands[i].in_use = true;
+            return &blkq_commands[i];
+        }
+    }
+    return 0;
+}
+
+// Hand one merged command to the device. Returns false if nothing was started.
+static bool blkq_dispatch(blkdev_t* dev) {
+    if(!dev->pending) return false;
+
+    blk_cmd_t* cmd = blkq_alloc_command();
+    if(!cmd) return false;
+
+    // C-SCAN: the first request at or past the head, else wrap to the lowest LBA
+    blk_request_t** link = &dev->pending;
+    while(*link && (*link)->lba < dev->head) link = &(*link)->next;
+    if(!*link) link = &dev->pending;
+
+    cmd->dev = dev;
+    cmd->write = (*link)->write;
+    cmd->lba = (*link)->lba;
+    cmd->count = 0;
+    cmd->nsegs = 0;
+    u64 end = cmd->lba;
+
+    // Pull out every request that starts exactly where the batch ends
+    while(*link && cmd->nsegs < BLKQ_MAX_SEGMENTS) {
+        blk_request_t* req = *link;
+
+        if(req->lba == end && req->write == cmd->write && cmd->count + req->count <= BLKQ_MAX_SECTORS) {
+            *link = req->next;
+            cmd->reqs[cmd->nsegs] = req;
+            cmd->segs[cmd->nsegs].buffer = req->buffer;
+            cmd->segs[cmd->nsegs].count = req->count;
+            cmd->count += req->count;
+            cmd->nsegs++;
+            end += req->count;
+        } else if(req->lba < end) {
+            link = &req->next;  // Same start as something already taken, leave it for later
+        } else {
+            break;
+        }
+    }
+
+    u64 old_head = dev->head;
+    dev->head = end;
+    dev->inflight++;
+    cmd->start_tick = timer_ticks;
+
+    if(!dev->start(dev, cmd)) {
+        // Device busy: put the batch back the way it was
+        dev->inflight--;
+        dev->head = old_head;
+        for(u32 i = cmd->nsegs; i-- > 0;) blkq_insert(dev, cmd->reqs[i], true);
+        cmd->in_use = false;
+        return false;
+    }
+    return true;
+}
+
+// Sleep until an interrupt arrives, unless one already has since 'seen'
+static void blkq_idle(u32 seen) {
+    __asm__ volatile("cli");
+    if(blkq_events == seen) {
+        __asm__ volatile("sti; hlt");
+    } else {
+        __asm__ volatile("sti");
+    }
+}
+
+// One pass over every device: collect finished commands, then start new ones
+// wherever there is room. Returns false once nothing is pending or in flight.
+static bool blkq_step(void) {
+    u32 seen = blkq_events;
+    u32 completions = blkq_completions;
+    bool started = false;
+    bool busy = false;
+    bool spin = false;
+
+    for(u32 i = 0; i < blkq_device_count; i++) {
+        blkdev_t* dev = blkq_devices[i];
+
+        if(dev->inflight && dev->poll) dev->poll(dev);
+
+        bool batch = false;
+        while(dev->pending && dev->inflight < dev->max_inflight) {
+            if(!blkq_dispatch(dev)) break;
+            batch = true;
+        }
+        if(batch && dev->kick) dev->kick(dev);
+        started |= batch;
+        if(dev->pending || dev->inflight) busy = true;
+        if(dev->inflight && dev->polled) spin = true;
+    }
+
+    if(busy && !started && !spin && completions == blkq_completions) blkq_idle(seen);
+    return busy;
+}
+
+// Dispatch everything that's pending, including requests submitted by callbacks
+void blkq_run(void) {
+    while(blkq_step());
+}
+
+// Service the queue until one particular request has completed
+bool blkq_wait(blk_request_t* req) {
+    while(!req->done && blkq_step());
+    return req->done && req->ok;
+}
+
+// Synchronous wrappers: one request per BLKQ_MAX_SECTORS chunk, waited on
+// immediately. Anything else already queued gets dispatched along the way.
+static bool blk_sync(u64 lba, u32 count, void* buffer, bool write) {
+    u8* data = (u8*)buffer;
+
+    while(count > 0) {
+        blk_request_t req;
+        req.dev = 0;
+        req.lba = lba;
+        req.count = (count > BLKQ_MAX_SECTORS) ? BLKQ_MAX_SECTORS : count;
+        req.buffer = data;
+        req.write = write;
+        req.callback = 0;
+        req.context = 0;
+
+        if(!blkq_submit(&req) || !blkq_wait(&req)) return false;
+
+        data += req.count * 512;
+        lba += req.count;
+        count -= req.count;
+    }
+    return true;
+}
+
+bool read_sectors(u64 lba, u32 count, void* buffer) {
+    return blk_sync(lba, count, buffer, false);
+}
+
+bool write_sectors(u64 lba, u32 count, const void* buffer) {
+    return blk_sync(lba, count, (void*)buffer, true);
+}
+
+// Commit the root device's write cache
+bool blk_flush(void) {
+    if(!blkq_root) return false;
+    blkq_run();
+    return blkq_root->flush ? blkq_root->flush(blkq_root) : true;
+}
+
+void blk_list_devices(void) {
+    if(blkq_device_count == 0) {
+        kprint("No block devices\n");
+        return;
+    }
+    for(u32 i = 0; i < blkq_device_count; i++) {
+        blkdev_t* dev = blkq_devices[i];
+        kprint(dev == blkq_root ? "* " : "  ");
+        kprint(dev->name);
+        kprint(": ");
+        kprint_dec((u32)(dev->sectors >> 11));
+        kprint(" MB, queue depth ");
+        kprint_dec(dev->max_inflight);
+        kprint("\n");
+    }
+}
+
+/*
+ * Read benchmark: keeps BLK_BENCH_DEPTH requests queued on every device at
+ * once and reports each device's throughput plus the total. With drives on
+ * both ATA channels the total should approach the sum of the two.
+ */
+#define BLK_BENCH_CHUNK  128       // Sectors per request
+#define BLK_BENCH_DEPTH  8         // Requests kept queued per device
+
+typedef struct {
+    u64 next;
+    u64 end;
+    u32 outstanding;
+    u32 finish_tick;
+    bool failed;
+} blk_bench_t;
+
+static blk_bench_t blk_bench_state[BLKQ_MAX_DEVICES];
+static blk_request_t blk_bench_reqs[BLKQ_MAX_DEVICES][BLK_BENCH_DEPTH];
+
+// Every request reads into the same scratch buffer; the data is thrown away.
+// Aligned so a request never straddles a 64KB DMA boundary, and kept in its
+// own section, which the linker script puts after the rest of the BSS so the
+// alignment only costs one gap (see linker.ld).
+static u8 blk_bench_buffer[BLK_BENCH_CHUNK * 512] __attribute__((aligned(0x10000), section(".bss.dma")));
+
+// Feed the next chunk from the same slot as soon as one completes
+static void blk_bench_done(blk_request_t* req) {
+    blk_bench_t* bench = (blk_bench_t*)req->context;
+
+    if(!req->ok) bench->failed = true;
+    if(!bench->failed && bench->next < bench->end) {
+        u64 left = bench->end - bench->next;
+        req->lba = bench->next;
+        req->count = (left > BLK_BENCH_CHUNK) ? BLK_BENCH_CHUNK : (u32)left;
+        bench->next += req->count;
+        if(blkq_submit(req)) return;
+        bench->failed = true;
+    }
+    if(--bench->outstanding == 0) bench->finish_tick = timer_ticks;
+}
+
+static void blk_bench_rate(u32 kb, u32 ticks) {
+    if(ticks == 0) ticks = 1;
+    kprint_dec(kb * TIMER_HZ / ticks);
+    kprint(" KB/s\n");
+}
+
+void blk_bench(u32 megabytes) {
+    if(blkq_device_count == 0) {
+        kprint("No block devices\n");
+        return;
+    }
+    if(megabytes == 0) megabytes = 1;
+    if(megabytes > 64) megabytes = 64;
+
+    blkq_run();
+    u32 start = timer_ticks;
+
+    for(u32 d = 0; d < blkq_device_count; d++) {
+        blkdev_t* dev = blkq_devices[d];
+        blk_bench_t* bench = &blk_bench_state[d];
+
+        bench->next = 0;
+        bench->end = (u64)megabytes << 11;
+        if(bench->end > dev->sectors) bench->end = dev->sectors;
+        bench->outstanding = 0;
+        bench->finish_tick = start;
+        bench->failed = false;
+
+        for(u32 i = 0; i < BLK_BENCH_DEPTH && bench->next < bench->end; i++) {
+            blk_request_t* req = &blk_bench_reqs[d][i];
+            u64 left = bench->end - bench->next;
+            req->dev = dev;
+            req->lba = bench->next;
+            req->count = (left > BLK_BENCH_CHUNK) ? BLK_BENCH_CHUNK : (u32)left;
+            req->buffer = blk_bench_buffer;
+            req->write = false;
+            req->callback = blk_bench_done;
+            req->context = bench;
+            if(!blkq_submit(req)) break;
+            bench->next += req->count;
+            bench->outstanding++;
+        }
+    }
+
+    blkq_run();
+    u32 total_kb = 0;
+
+    for(u32 d = 0; d < blkq_device_count; d++) {
+        blk_bench_t* bench = &blk_bench_state[d];
+        u32 kb = (u32)(bench->end >> 1);
+
+        kprint(blkq_devices[d]->name);
+        kprint(": ");
+        kprint_dec(kb);
+        kprint(" KB");
+        if(bench->failed) {
+            kprint(", read failed\n");
+            continue;
+        }
+        kprint(" at ");
+        blk_bench_rate(kb, bench->finish_tick - start);
+        total_kb += kb;
+    }
+
+    kprint("Total: ");
+    kprint_dec(total_kb);
+    kprint(" KB at ");
+    blk_bench_rate(total_kb, timer_ticks - start);
+}
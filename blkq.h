@@ -0,0 +1,123 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: blkq.h
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Header file for block devices and the block request queue.
+    Dependencies: types.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#pragma once
+#include "types.h"
+
+#define BLKQ_MAX_SECTORS  256  // Largest single request / merged command
+#define BLKQ_MAX_SEGMENTS 32   // Requests merged into one command at most
+#define BLKQ_MAX_DEVICES  8
+#define BLKQ_MAX_COMMANDS 16   // Merged commands in flight across all devices
+
+struct blkdev;
+struct blk_request;
+typedef void (*blk_callback_t)(struct blk_request* req);
+
+// One piece of memory in a scatter-gather command
+typedef struct {
+    void* buffer;
+    u32 count;       // Sectors
+} blk_segment_t;
+
+// A read or write of consecutive sectors. The caller owns the memory and must
+// keep it alive until the request is done. Requests queued at the same time
+// must not overlap, since the elevator is free to reorder them.
+typedef struct blk_request {
+    struct blkdev* dev;        // 0 means the root device
+    u64 lba;
+    u32 count;                 // Sectors, at most BLKQ_MAX_SECTORS
+    void* buffer;
+    bool write;
+    blk_callback_t callback;   // Called once the request completes (may be 0)
+    void* context;             // For the callback's use
+    volatile bool done;
+    bool ok;
+    struct blk_request* next;  // Queue link, owned by blkq
+} blk_request_t;
+
+// Merged command handed to a driver: consecutive sectors, one segment per request
+typedef struct {
+    struct blkdev* dev;
+    u64 lba;
+    u32 count;
+    bool write;
+    blk_segment_t segs[BLKQ_MAX_SEGMENTS];
+    blk_request_t* reqs[BLKQ_MAX_SEGMENTS];
+    u32 nsegs;
+    u32 start_tick;            // For driver timeouts
+    u32 tag;                   // Free for the driver to use
+    bool in_use;
+} blk_cmd_t;
+
+// A disk. Drivers fill in the top half and register it; the queue owns the rest.
+//   start: begin a command. Finished commands are handed back with blkq_complete,
+//          either before start returns (PIO) or later from poll (DMA, NCQ...).
+//          Returns false only if the device can't take a command right now.
+//   kick:  called after each pass that started commands, so drivers can ring
+//          the doorbell once for the whole batch (may be 0).
+//   poll:  check in-flight commands for completion or timeout.
+//   flush: commit the device's write cache (may be 0).
+// Devices without a working interrupt set 'polled', and the queue spins on
+// poll instead of sleeping while they have commands in flight.
+typedef struct blkdev {
+    char name[8];
+    u64 sectors;
+    u32 max_inflight;
+    bool polled;
+    bool (*start)(struct blkdev* dev, blk_cmd_t* cmd);
+    void (*kick)(struct blkdev* dev);
+    void (*poll)(struct blkdev* dev);
+    bool (*flush)(struct blkdev* dev);
+    void* driver;
+
+    blk_request_t* pending;    // Sorted by LBA, equal LBAs in submission order
+    u64 head;                  // LBA just past the last dispatched command
+    u32 inflight;
+} blkdev_t;
+
+void blkq_init(void);
+void blkdev_register(blkdev_t* dev);
+u32 blkdev_count(void);
+blkdev_t* blkdev_get(u32 index);
+blkdev_t* blkdev_find(const char* name);
+blkdev_t* blkdev_root(void);
+void blkdev_set_root(blkdev_t* dev);
+
+bool blkq_submit(blk_request_t* req);
+void blkq_complete(blk_cmd_t* cmd, bool ok);
+void blkq_notify(void);
+void blkq_run(void);
+bool blkq_wait(blk_request_t* req);
+
+// Synchronous sector I/O on the root device, built on the queue
+bool read_sectors(u64 lba, u32 count, void* buffer);
+bool write_sectors(u64 lba, u32 count, const void* buffer);
+bool blk_flush(void);
+
+void blk_list_devices(void);
+void blk_bench(u32 megabytes);
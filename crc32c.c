@@ -0,0 +1,129 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: crc32c.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: CRC32C (Castagnoli), using the SSE4.2 crc32 instruction when
+             the CPU has it and slice-by-8 tables when it doesn't.
+    Dependencies: types.h, crc32c.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+/*
+ * The crc32 instruction is an ordinary integer instruction (it doesn't touch
+ * the SSE registers), so it needs nothing set up beyond the CPUID check.
+ * It does four bytes per instruction here, since 32-bit code has no 64-bit
+ * form. Without it, slice-by-8 looks up eight tables per eight bytes
+ * instead of one table per byte. The tables (8KB) are built on first use.
+ */
+
+#include "types.h"
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78  // Castagnoli polynomial, bit-reversed
+
+static u32 crc32c_table[8][256];
+static bool crc32c_ready = false;
+static bool crc32c_sse42 = false;
+
+#if defined(__i386__) || defined(__x86_64__)
+static bool crc32c_cpu_has_sse42(void) {
+    u32 eax = 1, ebx, ecx, edx;
+    __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (ecx & (1u << 20)) != 0;  // CPUID.1:ECX.SSE4_2
+}
+
+static u32 crc32c_hw(u32 crc, const u8* p, u32 length) {
+    while(length && ((u32)(unsigned long)p & 3)) {
+        __asm__ ("crc32b %1, %0" : "+r"(crc) : "rm"(*p));
+        p++;
+        length--;
+    }
+    while(length >= 4) {
+        __asm__ ("crc32l %1, %0" : "+r"(crc) : "rm"(*(const u32*)p));
+        p += 4;
+        length -= 4;
+    }
+    while(length) {
+        __asm__ ("crc32b %1, %0" : "+r"(crc) : "rm"(*p));
+        p++;
+        length--;
+    }
+    return crc;
+}
+#else
+static bool crc32c_cpu_has_sse42(void) {
+    return false;
+}
+
+static u32 crc32c_hw(u32 crc, const u8* p, u32 length) {
+    (void)p;
+    (void)length;
+    return crc;
+}
+#endif
+
+static void crc32c_init(void) {
+    for(u32 i = 0; i < 256; i++) {
+        u32 crc = i;
+        for(u32 bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        crc32c_table[0][i] = crc;
+    }
+    for(u32 i = 0; i < 256; i++) {
+        for(u32 t = 1; t < 8; t++) {
+            u32 prev = crc32c_table[t - 1][i];
+            crc32c_table[t][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+    crc32c_sse42 = crc32c_cpu_has_sse42();
+    crc32c_ready = true;
+}
+
+static u32 crc32c_sw(u32 crc, const u8* p, u32 length) {
+    while(length && ((u32)(unsigned long)p & 3)) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+        length--;
+    }
+    while(length >= 8) {
+        u32 lo = *(const u32*)p ^ crc;
+        u32 hi = *(const u32*)(p + 4);
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+              crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+              crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+        p += 8;
+        length -= 8;
+    }
+    while(length--) crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+u32 crc32c(u32 crc, const void* data, u32 length) {
+    if(!crc32c_ready) crc32c_init();
+    crc = ~crc;
+    crc = crc32c_sse42 ? crc32c_hw(crc, (const u8*)data, length) : crc32c_sw(crc, (const u8*)data, length);
+    return ~crc;
+}
+
+bool crc32c_hardware(void) {
+    if(!crc32c_ready) crc32c_init();
+    return crc32c_sse42;
+}
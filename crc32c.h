@@ -0,0 +1,36 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: crc32c.h
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Header file for CRC32C (Castagnoli), used for KLFS block checksums.
+    Dependencies: types.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#pragma once
+#include "types.h"
+
+// Checksum of length bytes, continuing from crc (0 to start a new one)
+u32 crc32c(u32 crc, const void* data, u32 length);
+
+// True when the CPU's SSE4.2 crc32 instruction is doing the work
+bool crc32c_hardware(void);
@@ -19,7 +19,7 @@
     Created on: August 8th 2025
     Created by: jjones (GitHub Username: KlondikeDev)
     Purpose: Interrupt Descriptor Table.
-    Dependencies: types.h, idt.h, vga.h, kutils.h
+    Dependencies: types.h, idt.h, vga.h, kutils.h, ata.h
 
     Suggested Changes/Todo:
     Nothing Yet.
@@ -30,6 +30,7 @@
 #include "idt.h"
 #include "vga.h"
 #include "kutils.h"
+#include "ata.h"
 
 void idt_set_gate(u8 num, u32 base, u16 sel, u8 flags);
 void idt_init(void);
@@ -82,8 +83,8 @@ void irq_remap(void) {
     outb(PIC2_DATA, ICW4_8086);
     
     // Restore saved masks (but we'll set our own)
-    outb(PIC1_DATA, 0xFC);  // Mask all except IRQ 0 (timer) and IRQ 1 (keyboard)
-    outb(PIC2_DATA, 0xFF);  // Mask all slave PIC interrupts
+    outb(PIC1_DATA, 0xF8);  // Mask all except IRQ 0 (timer), IRQ 1 (keyboard) and IRQ 2 (cascade)
+    outb(PIC2_DATA, 0x3F);  // Mask all slave PIC interrupts except IRQ 14/15 (ATA)
 }
 
 // Install IRQ handlers
@@ -93,6 +94,11 @@ void irq_install(void) {
     // Install IRQ handlers in IDT
     idt_set_gate(32, (u32)irq0, CODE_SEG, IDT_INTERRUPT_GATE);  // Timer
     idt_set_gate(33, (u32)irq1, CODE_SEG, IDT_INTERRUPT_GATE);  // Keyboard
+    idt_set_gate(41, (u32)irq9, CODE_SEG, IDT_INTERRUPT_GATE);  // PCI
+    idt_set_gate(42, (u32)irq10, CODE_SEG, IDT_INTERRUPT_GATE); // PCI
+    idt_set_gate(43, (u32)irq11, CODE_SEG, IDT_INTERRUPT_GATE); // PCI
+    idt_set_gate(46, (u32)irq14, CODE_SEG, IDT_INTERRUPT_GATE); // Primary ATA
+    idt_set_gate(47, (u32)irq15, CODE_SEG, IDT_INTERRUPT_GATE); // Secondary ATA
 }
 
 // Static IDT table and descriptor
@@ -206,6 +212,35 @@ void isr_handler(registers_t* regs) {
     
     while(1) { __asm__ volatile ("hlt"); }
 }
+// Handlers registered for the PCI interrupt lines
+#define IRQ_PCI_FIRST  9
+#define IRQ_PCI_LAST   11
+#define IRQ_SHARED_MAX 4
+
+typedef struct {
+    irq_callback_t callback;
+    void* context;
+} irq_slot_t;
+
+static irq_slot_t irq_slots[IRQ_PCI_LAST - IRQ_PCI_FIRST + 1][IRQ_SHARED_MAX];
+
+// Attach a handler to a PCI interrupt line and unmask it on the slave PIC.
+// Returns false if the line isn't one we have a stub for, or it's full.
+bool irq_register(u8 irq, irq_callback_t callback, void* context) {
+    if(irq < IRQ_PCI_FIRST || irq > IRQ_PCI_LAST) return false;
+
+    irq_slot_t* slots = irq_slots[irq - IRQ_PCI_FIRST];
+    for(int i = 0; i < IRQ_SHARED_MAX; i++) {
+        if(!slots[i].callback) {
+            slots[i].context = context;
+            slots[i].callback = callback;
+            outb(PIC2_DATA, inb(PIC2_DATA) & ~(1 << (irq - 8)));
+            return true;
+        }
+    }
+    return false;
+}
+
 // Send End of Interrupt to PIC
 void irq_ack(u8 irq) {
     if (irq >= 8) {
@@ -217,10 +252,24 @@ void irq_ack(u8 irq) {
 void irq_handler(registers_t* regs) {
     switch(regs->int_no) {
         case 32:  // Timer
+            timer_ticks++;
             break;
         case 33:  // Keyboard
             read_key_from_port();
             break;
+        case 46:  // Primary ATA
+        case 47:  // Secondary ATA
+            ata_irq_handler(regs->int_no - 32);
+            break;
+        case 41:  // PCI
+        case 42:
+        case 43: {
+            irq_slot_t* slots = irq_slots[regs->int_no - 32 - IRQ_PCI_FIRST];
+            for(int i = 0; i < IRQ_SHARED_MAX && slots[i].callback; i++) {
+                slots[i].callback(slots[i].context);
+            }
+            break;
+        }
         default:
             kprint("Unknown IRQ!\n");
             break;
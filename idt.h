@@ -72,6 +72,11 @@ void isr16(void);
 // IRQ handler declarations
 void irq0(void);
 void irq1(void);
+void irq9(void);
+void irq10(void);
+void irq11(void);
+void irq14(void);
+void irq15(void);
 // IRQ handler function
 void irq_handler(registers_t* regs);
 
@@ -79,4 +84,9 @@ void irq_handler(registers_t* regs);
 void irq_remap(void);
 void irq_install(void);
 
+// Handlers for PCI devices on IRQ 9-11. Lines can be shared, so every handler
+// on a line is called and each one checks whether its device interrupted.
+typedef void (*irq_callback_t)(void* context);
+bool irq_register(u8 irq, irq_callback_t callback, void* context);
+
 void read_key_from_port(void);
\ No newline at end of file
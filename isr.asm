@@ -118,6 +118,11 @@ isr_common_stub:
 ; Create IRQ handlers
 IRQ 0, 32                      ; Timer (IRQ 0 → Interrupt 32)
 IRQ 1, 33                      ; Keyboard (IRQ 1 → Interrupt 33)
+IRQ 9, 41                      ; PCI (IRQ 9 → Interrupt 41)
+IRQ 10, 42                     ; PCI (IRQ 10 → Interrupt 42)
+IRQ 11, 43                     ; PCI (IRQ 11 → Interrupt 43)
+IRQ 14, 46                     ; Primary ATA (IRQ 14 → Interrupt 46)
+IRQ 15, 47                     ; Secondary ATA (IRQ 15 → Interrupt 47)
 
 ; Common IRQ handler for hardware interrupts
 extern irq_handler
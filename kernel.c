@@ -19,7 +19,7 @@
     Created on: August 7th 2025
     Created by: jjones (GitHub Username: KlondikeDev)
     Purpose: To setup the kernel of WingspanOS.
-    Dependencies: types.h, vga.h, idt.h, kutils.h, music.h, ata.h
+    Dependencies: types.h, vga.h, idt.h, kutils.h, music.h, ata.h, bcache.h, blkq.h, ahci.h, virtio_blk.h
 
     Suggested Changes/Todo:
     Anything! The kernel in this case, IS THE OS.
@@ -33,6 +33,16 @@
 #include "kutils.h"
 #include "music.h"
 #include "ata.h"
+#include "klfs.h"
+#include "bcache.h"
+#include "blkq.h"
+#include "ahci.h"
+#include "virtio_blk.h"
+
+// Disk KLFS uses at boot, normally set by the Makefile (make BOOT_DISK=vda)
+#ifndef BOOT_DISK
+#define BOOT_DISK "hda"
+#endif
 
 // Input handling
 u16 input_start_row = 0;
@@ -58,9 +68,20 @@ void kmain() {
 
     // Initialize IDT after basic output is working
     idt_init();
+    timer_init(TIMER_HZ);
 
     // Initialize ATA/disk
+    blkq_init();
+    bcache_init();
     detect_drives();
+    ahci_init();
+    virtio_blk_init();
+
+    blkdev_t* boot_disk = blkdev_find(BOOT_DISK);
+    if (boot_disk) {
+        blkdev_set_root(boot_disk);
+        klfs_mount();
+    }
 
     kprint("Copyright (C) 2025 Joseph Jones (KlondikeDev)\n");
     kprint("Licensed under Apache License 2.0\n\n");
@@ -72,6 +93,8 @@ void kmain() {
     input_start_row = row;
     input_start_col = col;
 
+    u32 next_flush = timer_ticks + KLFS_FLUSH_SECONDS * TIMER_HZ;
+
     while (1) {
         if (line_ready) {
             static char command[256];
@@ -87,8 +110,9 @@ void kmain() {
                 kprint("Available commands:\n");
                 kprint("| UTILITIES:\n");
                 kprint("| GENERAL:    help, wash, about, reboot, rtc\n");
-                kprint("| FILESYSTEM: drives, format, diskinfo, verify, ls, touch, cat, write, \n");
-                kprint("|             rm, cp, find\n");
+                kprint("| FILESYSTEM: drives, format, mount, umount, diskinfo, verify, ls, touch,\n");
+                kprint("|             cat, write, append, rm, cp, find, grep, compress, uncompress,\n");
+                kprint("|             sync, cachestat, rastat, disk, diskbench\n");
                 kprint("|_\n");
                 kprint("MISC: echo, play\n");
             }
@@ -105,6 +129,7 @@ void kmain() {
                 kprint("\n");
             }
             else if (str_equals(command, "reboot")) {
+                klfs_sync();  // Don't lose cached writes or pending metadata
                 reboot_system();
             }
             else if (starts_with(command, "play ")) {
@@ -158,11 +183,62 @@ void kmain() {
             }
             else if (str_equals(command, "format")) {
                 kprint("Formatting drive with KLFS...\n");
-                klfs_format();
+                klfs_format(0);
+            }
+            else if (starts_with(command, "format ")) {
+                // Size in MB, or with a K/M/G suffix
+                // Counted in 64 bits, so a size past KLFS's 32-bit block
+                // numbers is refused instead of wrapping around
+                const char* size = command + 7;
+                u32 digits = 0;
+                u64 blocks = 0;
+                while (size[digits] >= '0' && size[digits] <= '9') {
+                    if (blocks <= 0xFFFFFFFF) blocks = blocks * 10 + (u32)(size[digits] - '0');
+                    digits++;
+                }
+                char unit = size[digits];
+                if (unit == 'G' || unit == 'g') blocks <<= 20;
+                else if (unit != 'K' && unit != 'k') blocks <<= 10;
+                if (digits == 0 || blocks == 0) {
+                    kprint("Usage: format [size[K|M|G]]\n");
+                } else if (blocks > 0xFFFFFFFF) {
+                    kprint("Error: KLFS can't be larger than 4294967295 blocks (4 TB)\n");
+                } else {
+                    kprint("Formatting drive with KLFS...\n");
+                    klfs_format((u32)blocks);
+                }
+            }
+            else if (str_equals(command, "mount")) {
+                klfs_mount();
+            }
+            else if (str_equals(command, "umount")) {
+                if (klfs_umount()) {
+                    kprint("KLFS unmounted, safe to power off\n");
+                }
             }
             else if (str_equals(command, "diskinfo")) {
-                kprint("Identifying primary master drive...\n");
-                identify_drive(0xA0);
+                ata_print_drives();
+                ahci_print_drives();
+                virtio_blk_print();
+            }
+            else if (str_equals(command, "disk")) {
+                blk_list_devices();
+            }
+            else if (starts_with(command, "disk ")) {
+                blkdev_t* dev = blkdev_find(command + 5);
+                if (!dev) {
+                    kprint("Error: No such disk\n");
+                } else if (klfs_umount()) {
+                    bcache_init();  // Cached blocks belong to the old disk
+                    blkdev_set_root(dev);
+                    kprint("KLFS now uses "); kprint(dev->name); kprint("\n");
+                }
+            }
+            else if (str_equals(command, "diskbench")) {
+                blk_bench(4);
+            }
+            else if (starts_with(command, "diskbench ")) {
+                blk_bench(str_to_uint(command + 10));
             } else if (str_equals(command, "verify")) {
                 klfs_verify();
             } else if (str_equals(command, "ls")) {
@@ -194,6 +270,21 @@ void kmain() {
                     const char* text = args + space_pos + 1;
                     klfs_write_file(filename, text);
                 }
+            } else if (starts_with(command, "append ")) {
+                // Format: append filename text
+                const char* args = command + 7;
+                u32 space_pos = 0;
+                while(args[space_pos] && args[space_pos] != ' ') space_pos++;
+    
+                if(args[space_pos] == 0) {
+                    kprint("Usage: append <filename> <text>\n");
+                } else {
+                    char filename[32] = {0};
+                    for(u32 i = 0; i < space_pos && i < 31; i++) {
+                        filename[i] = args[i];
+                    }
+                    klfs_append_file(filename, args + space_pos + 1);
+                }
             } else if (starts_with(command, "cat ")) {
                 const char* filename = command + 4;
                 klfs_read_file(filename);
@@ -222,9 +313,37 @@ void kmain() {
                     const char* dest = args + space_pos + 1;
                     klfs_copy_file(source, dest);
                 }
+            } else if (starts_with(command, "compress ")) {
+                klfs_compress_file(command + 9, true);
+            } else if (starts_with(command, "uncompress ")) {
+                klfs_compress_file(command + 11, false);
+            } else if (str_equals(command, "sync")) {
+                if (klfs_sync()) {
+                    kprint("Cache flushed to disk\n");
+                } else {
+                    kprint("Error: Failed to flush cache\n");
+                }
+            } else if (str_equals(command, "cachestat")) {
+                bcache_stats();
+            } else if (str_equals(command, "rastat")) {
+                bcache_ra_stats();
             } else if (starts_with(command, "find ")) {
                 const char* pattern = command + 5;
                 klfs_find_file(pattern);
+            } else if (starts_with(command, "grep ")) {
+                const char* args = command + 5;
+                u32 space_pos = 0;
+                while(args[space_pos] && args[space_pos] != ' ') space_pos++;
+
+                if(args[space_pos] == 0 || space_pos > 64) {
+                    kprint("Usage: grep <text> <file or pattern, e.g. *.log>\n");
+                } else {
+                    char text[65] = {0};
+                    for(u32 i = 0; i < space_pos; i++) {
+                        text[i] = args[i];
+                    }
+                    klfs_grep(text, args + space_pos + 1);
+                }
             } else {
                 kprint("Syntax Error. 1\n");
             }
@@ -237,6 +356,13 @@ void kmain() {
             update_cursor(row, col);
         }
 
+        // Write back pending metadata and data every KLFS_FLUSH_SECONDS.
+        // The signed difference keeps working when timer_ticks wraps.
+        if ((i32)(timer_ticks - next_flush) >= 0) {
+            klfs_flush();
+            next_flush = timer_ticks + KLFS_FLUSH_SECONDS * TIMER_HZ;
+        }
+
         __asm__ volatile ("hlt");
     }
 }
@@ -26,6 +26,8 @@
 
 [BITS 32]
 [EXTERN kmain]
+[EXTERN __bss_start]
+[EXTERN __bss_end]
 
 global _start
 
@@ -34,13 +36,32 @@ _start:
     ; We're already in protected mode with segments set up
     ; Just need to ensure stack is properly aligned and call kmain
     
-    ; Set up stack (ensure 16-byte alignment for modern calling conventions)
-    mov esp, 0x90000
+    ; Set up stack (ensure 16-byte alignment for modern calling conventions).
+    ; It goes at the top of conventional memory, just under the BIOS's
+    ; extended data area, whose segment the BIOS data area holds at 0x40E.
+    ; The BSS below may reach up to 0x90000 (see linker.ld).
+    movzx esp, word [0x40E]
+    shl esp, 4
+    cmp esp, 0x90000
+    jb .default_stack    ; No sensible EBDA pointer
+    cmp esp, 0xA0000
+    jbe .stack_set
+.default_stack:
+    mov esp, 0x9F000
+.stack_set:
     and esp, 0xFFFFFFF0  ; Align to 16 bytes
     
     ; Clear direction flag
     cld
     
+    ; Zero the BSS. It isn't part of the flat binary, so until now it holds
+    ; whatever the BIOS and bootloader left in that memory.
+    mov edi, __bss_start
+    mov ecx, __bss_end
+    sub ecx, edi
+    xor eax, eax
+    rep stosb
+    
     ; Push a fake return address (we should never return from kmain)
     push 0
     
@@ -0,0 +1,3219 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: klfs.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: KLFS, the filesystem, on top of the block cache. Nothing in here
+             touches hardware, so the same file also builds for Linux against
+             a disk image (see tools/).
+    Dependencies: types.h, vga.h, kutils.h, klfs.h, bcache.h, blkq.h, crc32c.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+/*
+ * KLFS (Klondike Little Filesystem) and KFS (Klondike Filesystem) 
+ * Created by Joseph Jones (KlondikeDev)
+ * Original implementation and design
+ */
+
+#include "types.h"
+#include "vga.h"
+#include "kutils.h"
+#include "klfs.h"
+#include "bcache.h"
+#include "blkq.h"
+#include "crc32c.h"
+
+#define KLFS_INLINE_MAX 64  // Files up to this size live in their directory entry
+
+typedef struct {
+    char name[32];        // Filename (null-terminated)
+    u32 size;            // File size in bytes
+    u32 extent_block;    // Block holding the file's extent map, 0 = no data blocks
+    u32 block_count;     // How many blocks the file spans, holes included
+    u8 used;             // 1 if entry is used, 0 if free
+    u8 flags;            // KLFS_FILE_* bits
+    u8 reserved[2];      // Padding
+    u8 inline_data[KLFS_INLINE_MAX];  // Contents of a small file, zero past size
+} klfs_file_entry_t;
+
+#define KLFS_MAGIC 0x4B4C4653
+#define KLFS_FILE_SHARED 0x01  // Some of the file's blocks may be shared with a copy
+#define KLFS_FILE_COMPRESSED 0x02  // Data is stored in compressed chunks
+#define KLFS_FILE_SPARSE 0x04  // Some of the file's blocks may be holes, with no disk block
+#define KLFS_DIR_ENTRIES 9  // File entries per directory block
+
+typedef struct {
+    u32 magic;                           // 0x4B4C4653
+    u32 total_blocks;                    // Total blocks on disk
+    u32 free_blocks;                     // Free blocks available
+    u32 file_count;                      // Number of files
+    u32 group_table;                     // First block of the group table (free blocks per group)
+    u32 group_count;                     // Allocation groups (see "Allocation groups" below)
+    u32 data_start;                      // First block after the global metadata (group 0's bitmap)
+    u32 dir_root;                        // Directory root block (see "Directory" below)
+    u32 dir_buckets;                     // Hash buckets in the directory, a power of two
+    u32 journal_start;                   // First block of the metadata journal
+    u32 journal_blocks;                  // Journal length in blocks
+    u32 group_blocks;                    // Blocks per group, KLFS_GROUP_BLOCKS
+    u32 group_meta;                      // Metadata blocks at the start of each group
+    u32 shared_blocks;                   // Extra references in the table, 0 = nothing shared
+    u8 reserved[968];                    // Reserved space
+} klfs_superblock_t;
+
+typedef struct {
+    u32 next;                                     // Next block in this bucket's chain, 0 = last
+    u32 count;                                    // Entries in use in this block
+    u8 reserved[8];                               // Padding to align entries
+    klfs_file_entry_t entries[KLFS_DIR_ENTRIES];  // File entries (9 * 112 = 1008 bytes)
+} klfs_dir_block_t;
+
+// A file's data is a list of extents, each a run of consecutive disk blocks
+// holding consecutive blocks of the file, kept in file order. In a compressed
+// file an extent may hold its blocks compressed into fewer disk blocks.
+typedef struct {
+    u32 logical;  // First file block the extent holds
+    u32 start;    // First disk block
+    u16 count;    // Length in file blocks
+    u16 stored;   // Disk blocks holding them compressed, 0 = stored as is
+} klfs_extent_t;
+
+#define KLFS_MAX_EXTENTS 84
+#define KLFS_EXTENT_MAX  0xFFFF  // Longest extent, in blocks
+
+// Zero blocks are only left out as holes while the map is less full than
+// this, so a file with zeros scattered through it can't run out of extents
+#define KLFS_SPARSE_EXTENTS (KLFS_MAX_EXTENTS / 2)
+
+typedef struct {
+    u32 count;                                // Extents in use
+    u32 reserved;
+    klfs_extent_t extents[KLFS_MAX_EXTENTS];  // 84 * 12 = 1008 bytes
+    u8 padding[8];
+} klfs_extent_map_t;
+
+static bool klfs_meta_read(u32 block, void* buffer);
+static bool klfs_meta_write(u32 block, const void* buffer);
+static bool klfs_csum_check(u32 block_num, u32 count, const void* data);
+static bool klfs_csum_update(u32 block_num, u32 count, const void* data);
+static void klfs_mcache_update(u32 block_num, u32 count, const void* data);
+
+// KLFS block I/O (1KB = 2 sectors). Single blocks go through the write-back
+// block cache; see bcache.c. Every block is checked against its checksum
+// when read and has it updated when written (see "Checksums" below), and
+// writes keep the metadata cache current (see "Metadata cache").
+bool read_block(u32 block_num, void* buffer) {
+    return bcache_read(block_num, buffer) && klfs_csum_check(block_num, 1, buffer);
+}
+
+bool write_block(u32 block_num, void* buffer) {
+    klfs_mcache_update(block_num, 1, buffer);
+    return bcache_write(block_num, buffer) && klfs_csum_update(block_num, 1, buffer);
+}
+
+// Contiguous runs of blocks go out as one multi-sector transfer
+bool read_blocks(u32 block_num, u32 count, void* buffer) {
+    return bcache_read_run(block_num, count, buffer) && klfs_csum_check(block_num, count, buffer);
+}
+
+bool write_blocks(u32 block_num, u32 count, const void* buffer) {
+    klfs_mcache_update(block_num, count, buffer);
+    return bcache_write_run(block_num, count, buffer) && klfs_csum_update(block_num, count, buffer);
+}
+
+// Allocation groups
+// The disk is split into groups of KLFS_GROUP_BLOCKS blocks, each with its
+// own metadata at its start: a free-block bitmap (one bit per block of the
+// group, set when in use), the group's reference counts and the checksums of
+// its blocks. Group 0's
+// metadata follows the global metadata (superblock, directory root, journal
+// and the group table, which holds each group's free count). A few group
+// bitmaps are kept in memory at a time, so the cost of allocating doesn't
+// grow with the disk: the search looks at the free counts to skip full
+// groups, then scans one bitmap block. Allocation is next-fit within a group
+// and stays in the group of the previous allocation while it has room.
+// Each bitmap held in memory also keeps the copy last committed by the
+// journal: blocks freed since the last commit aren't handed out again until
+// that commit is on disk, since until then a crash brings back the files
+// that still point at them.
+#define KLFS_BLOCK_SIZE     1024
+#define KLFS_BITS_PER_BLOCK (KLFS_BLOCK_SIZE * 8)
+#define KLFS_GROUP_BLOCKS   KLFS_BITS_PER_BLOCK  // One bitmap block per group
+#define KLFS_REFS_PER_BLOCK KLFS_BLOCK_SIZE      // One reference count byte per block
+#define KLFS_REF_BLOCKS     (KLFS_GROUP_BLOCKS / KLFS_REFS_PER_BLOCK)
+#define KLFS_SUMS_PER_BLOCK (KLFS_BLOCK_SIZE / 4)  // One CRC32C per block
+#define KLFS_SUM_BLOCKS     (KLFS_GROUP_BLOCKS / KLFS_SUMS_PER_BLOCK)
+#define KLFS_GROUP_META     (1 + KLFS_REF_BLOCKS + KLFS_SUM_BLOCKS)  // Bitmap, reference counts, checksums
+#define KLFS_GROUPS_PER_TABLE_BLOCK (KLFS_BLOCK_SIZE / 4)
+#define KLFS_GROUP_SLOTS    8    // Group bitmaps held in memory
+#define KLFS_TX_GROUPS      4    // Groups a long update changes per transaction
+#define KLFS_MIN_BLOCKS     128  // Smallest disk format accepts
+
+typedef struct {
+    u32 group;                      // Group held, 0xFFFFFFFF = none
+    u32 free;                       // Free blocks in the group
+    bool dirty;                     // Changed since last written back
+    u32 bits[KLFS_BLOCK_SIZE / 4];  // Bitmap, including this transaction
+    u32 base[KLFS_BLOCK_SIZE / 4];  // Bitmap as of the last journal commit
+} klfs_group_slot_t;
+
+static klfs_group_slot_t klfs_groups[KLFS_GROUP_SLOTS];
+static u32 klfs_group_clock = 0;   // Next slot to consider for eviction
+static u32 klfs_alloc_hint = 0;    // Where the next allocation search starts
+static bool klfs_mounted = false;  // Journal replayed for the current disk
+static klfs_superblock_t klfs_super;  // Its superblock as on disk, while mounted
+
+static void klfs_journal_reset(void);
+static void klfs_mcache_drop(void);
+static void klfs_chunk_forget(void);
+static void klfs_csum_off(void);
+
+// Drop the group bitmaps held in memory; they're read again (from the
+// journal or disk) on next use
+static void klfs_groups_drop(void) {
+    for(u32 i = 0; i < KLFS_GROUP_SLOTS; i++) {
+        klfs_groups[i].group = 0xFFFFFFFF;
+        klfs_groups[i].dirty = false;
+    }
+}
+
+// Forget everything held in memory about the disk, e.g. after switching disks,
+// so the next operation mounts it again. Uncommitted metadata is dropped;
+// call klfs_sync first to keep it.
+void klfs_invalidate(void) {
+    klfs_groups_drop();
+    klfs_mcache_drop();
+    klfs_csum_off();
+    klfs_mounted = false;
+    klfs_journal_reset();
+    klfs_chunk_forget();
+}
+
+// First metadata block of a group: its bitmap, then its reference counts
+// and checksums
+static u32 klfs_group_meta(klfs_superblock_t* sb, u32 group) {
+    return group == 0 ? sb->data_start : group * KLFS_GROUP_BLOCKS;
+}
+
+// Checksums
+// Each group keeps a CRC32C for every one of its blocks, KLFS_SUM_BLOCKS
+// blocks after its reference counts. The block I/O functions check them on
+// every read and update them on every write, so metadata and file data are
+// covered alike. Left out are the superblock (read before the layout is
+// known, and checked field by field), the journal (it has its own checksum)
+// and the checksum blocks themselves. A stored 0 means no checksum yet.
+// The checksum blocks are written back through the cache like any other
+// block. Metadata is journaled, so a replay rewrites it and its checksums
+// together. File data isn't: a crash while a block is being rewritten can
+// leave it and its checksum out of step, and verify reports it.
+static bool klfs_csum_on = false;     // Layout below is set (disk mounted)
+static u32 klfs_csum_total;           // sb->total_blocks
+static u32 klfs_csum_data_start;      // sb->data_start, where group 0's metadata is
+static u32 klfs_csum_journal_start;
+static u32 klfs_csum_journal_end;
+static u32 klfs_sums[KLFS_SUMS_PER_BLOCK];  // One checksum block held in memory
+static u32 klfs_sums_block = 0;             // Which one, 0 = none
+static bool klfs_sums_dirty = false;        // Changed since it was put back in the cache
+static u32 klfs_csum_errors = 0;            // Mismatches seen since mounting
+
+static void klfs_csum_setup(klfs_superblock_t* sb) {
+    klfs_csum_total = sb->total_blocks;
+    klfs_csum_data_start = sb->data_start;
+    klfs_csum_journal_start = sb->journal_start;
+    klfs_csum_journal_end = sb->journal_start + sb->journal_blocks;
+    klfs_sums_block = 0;
+    klfs_sums_dirty = false;
+    klfs_csum_errors = 0;
+    klfs_csum_on = true;
+}
+
+static void klfs_csum_off(void) {
+    klfs_csum_on = false;
+    klfs_sums_block = 0;
+}
+
+// First checksum block of the group holding this block
+static u32 klfs_sum_first(u32 block) {
+    u32 group = block / KLFS_GROUP_BLOCKS;
+    u32 meta = group == 0 ? klfs_csum_data_start : group * KLFS_GROUP_BLOCKS;
+    return meta + 1 + KLFS_REF_BLOCKS;
+}
+
+static bool klfs_csum_covered(u32 block) {
+    if(!klfs_csum_on || block == 0 || block >= klfs_csum_total) return false;
+    if(block >= klfs_csum_journal_start && block < klfs_csum_journal_end) return false;
+    u32 first = klfs_sum_first(block);
+    return block < first || block >= first + KLFS_SUM_BLOCKS;
+}
+
+// Put the held checksum block back in the cache if it was changed
+static bool klfs_sums_write(void) {
+    if(klfs_sums_dirty && !bcache_write(klfs_sums_block, klfs_sums)) {
+        kprint("Error: Failed to write checksums\n");
+        return false;
+    }
+    klfs_sums_dirty = false;
+    return true;
+}
+
+// Checksum slot for a block, with its checksum block loaded into klfs_sums
+static u32* klfs_sum_slot(u32 block) {
+    u32 sum_block = klfs_sum_first(block) + (block % KLFS_GROUP_BLOCKS) / KLFS_SUMS_PER_BLOCK;
+    if(sum_block != klfs_sums_block) {
+        if(!klfs_sums_write()) return 0;
+        if(!bcache_read(sum_block, klfs_sums)) {
+            kprint("Error: Failed to read checksums\n");
+            klfs_sums_block = 0;
+            return 0;
+        }
+        klfs_sums_block = sum_block;
+    }
+    return &klfs_sums[block % KLFS_SUMS_PER_BLOCK];
+}
+
+static bool klfs_csum_check(u32 block_num, u32 count, const void* data) {
+    const u8* p = (const u8*)data;
+    for(u32 i = 0; i < count; i++) {
+        u32 block = block_num + i;
+        if(!klfs_csum_covered(block)) continue;
+        u32* slot = klfs_sum_slot(block);
+        if(!slot) return false;
+        if(*slot && *slot != crc32c(0, p + i * KLFS_BLOCK_SIZE, KLFS_BLOCK_SIZE)) {
+            kprint("Error: Checksum mismatch in block "); kprint_dec(block); kprint("\n");
+            klfs_csum_errors++;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool klfs_csum_update(u32 block_num, u32 count, const void* data) {
+    const u8* p = (const u8*)data;
+    for(u32 i = 0; i < count; i++) {
+        u32 block = block_num + i;
+        if(!klfs_csum_covered(block)) continue;
+        u32* slot = klfs_sum_slot(block);
+        if(!slot) return false;
+        *slot = crc32c(0, p + i * KLFS_BLOCK_SIZE, KLFS_BLOCK_SIZE);
+        klfs_sums_dirty = true;
+    }
+    return klfs_sums_write();
+}
+
+static bool klfs_group_read_free(klfs_superblock_t* sb, u32 group, u32* free) {
+    u32 table[KLFS_GROUPS_PER_TABLE_BLOCK];
+    if(!klfs_meta_read(sb->group_table + group / KLFS_GROUPS_PER_TABLE_BLOCK, table)) {
+        kprint("Error: Failed to read group table\n");
+        return false;
+    }
+    *free = table[group % KLFS_GROUPS_PER_TABLE_BLOCK];
+    return true;
+}
+
+// Write a changed group bitmap and free count back through the journal
+static bool klfs_group_flush(klfs_superblock_t* sb, klfs_group_slot_t* slot) {
+    u32 table[KLFS_GROUPS_PER_TABLE_BLOCK];
+    u32 table_block = sb->group_table + slot->group / KLFS_GROUPS_PER_TABLE_BLOCK;
+
+    if(!slot->dirty) return true;
+    if(!klfs_meta_write(klfs_group_meta(sb, slot->group), slot->bits)) {
+        kprint("Error: Failed to write free-block bitmap\n");
+        return false;
+    }
+    if(!klfs_meta_read(table_block, table)) {
+        kprint("Error: Failed to read group table\n");
+        return false;
+    }
+    table[slot->group % KLFS_GROUPS_PER_TABLE_BLOCK] = slot->free;
+    if(!klfs_meta_write(table_block, table)) {
+        kprint("Error: Failed to write group table\n");
+        return false;
+    }
+    slot->dirty = false;
+    return true;
+}
+
+// Get a group's bitmap into memory, writing back another one to make room
+// if needed
+static klfs_group_slot_t* klfs_group_get(klfs_superblock_t* sb, u32 group) {
+    for(u32 i = 0; i < KLFS_GROUP_SLOTS; i++) {
+        if(klfs_groups[i].group == group) return &klfs_groups[i];
+    }
+
+    klfs_group_slot_t* slot = 0;
+    for(u32 i = 0; i < KLFS_GROUP_SLOTS && !slot; i++) {
+        if(klfs_groups[i].group == 0xFFFFFFFF) slot = &klfs_groups[i];
+    }
+    if(!slot) {
+        slot = &klfs_groups[klfs_group_clock];
+        klfs_group_clock = (klfs_group_clock + 1) % KLFS_GROUP_SLOTS;
+        if(!klfs_group_flush(sb, slot)) return 0;
+    }
+
+    // What the journal last committed is what's in the home location
+    slot->group = 0xFFFFFFFF;
+    u32 home = klfs_group_meta(sb, group);
+    if(!klfs_meta_read(home, slot->bits) || !read_block(home, slot->base)) {
+        kprint("Error: Failed to read free-block bitmap\n");
+        return 0;
+    }
+    if(!klfs_group_read_free(sb, group, &slot->free)) return 0;
+    slot->group = group;
+    slot->dirty = false;
+    return slot;
+}
+
+static bool klfs_bit(const u32* bits, u32 index) {
+    return (bits[index / 32] >> (index % 32)) & 1;
+}
+
+// Set or clear a run of bits within one group. Returns how many actually changed.
+static u32 klfs_mark(klfs_group_slot_t* slot, u32 index, u32 count, bool used) {
+    u32 changed = 0;
+    for(u32 i = index; i < index + count; i++) {
+        if(klfs_bit(slot->bits, i) == used) continue;
+        slot->bits[i / 32] ^= 1u << (i % 32);
+        changed++;
+    }
+    if(used) {
+        slot->free -= changed;
+    } else {
+        slot->free += changed;
+    }
+    if(changed) slot->dirty = true;
+    return changed;
+}
+
+// In use, or freed too recently to reuse
+static bool klfs_busy(klfs_group_slot_t* slot, u32 index) {
+    return ((slot->bits[index / 32] | slot->base[index / 32]) >> (index % 32)) & 1;
+}
+
+// Next-fit search of one group for count contiguous free blocks, starting at
+// index from and wrapping around once. Whole words of used blocks are
+// skipped at once.
+static bool klfs_group_search(klfs_group_slot_t* slot, u32 from, u32 count, u32* found) {
+    u32 run_start = 0, run_length = 0;
+    u32 index = from;
+
+    for(u32 scanned = 0; scanned < KLFS_GROUP_BLOCKS + count; ) {
+        if(index >= KLFS_GROUP_BLOCKS) {
+            index = 0;
+            run_length = 0;
+        }
+        if(run_length == 0 && (index % 32) == 0 &&
+           (slot->bits[index / 32] | slot->base[index / 32]) == 0xFFFFFFFF) {
+            index += 32;
+            scanned += 32;
+            continue;
+        }
+
+        if(klfs_busy(slot, index)) {
+            run_length = 0;
+        } else {
+            if(run_length == 0) run_start = index;
+            if(++run_length == count) {
+                *found = run_start;
+                return true;
+            }
+        }
+        index++;
+        scanned++;
+    }
+    return false;
+}
+
+// Find and claim count contiguous free blocks. A run never crosses groups.
+static bool klfs_alloc_run(klfs_superblock_t* sb, u32 count, u32* start) {
+    if(count == 0 || count > sb->free_blocks || count > KLFS_GROUP_BLOCKS - KLFS_GROUP_META) return false;
+
+    u32 group = klfs_alloc_hint / KLFS_GROUP_BLOCKS;
+    if(group >= sb->group_count) group = 0;
+    u32 from = klfs_alloc_hint % KLFS_GROUP_BLOCKS;
+
+    for(u32 tried = 0; tried < sb->group_count; tried++) {
+        // Free counts come from the bitmap when it's in memory (it may have
+        // changed since the table was written), else from the group table
+        klfs_group_slot_t* slot = 0;
+        for(u32 i = 0; i < KLFS_GROUP_SLOTS; i++) {
+            if(klfs_groups[i].group == group) slot = &klfs_groups[i];
+        }
+        u32 free;
+        if(slot) {
+            free = slot->free;
+        } else if(!klfs_group_read_free(sb, group, &free)) {
+            return false;
+        }
+
+        u32 index;
+        if(free >= count) {
+            if(!slot && !(slot = klfs_group_get(sb, group))) return false;
+            if(klfs_group_search(slot, from, count, &index)) {
+                klfs_mark(slot, index, count, true);
+                sb->free_blocks -= count;
+                *start = group * KLFS_GROUP_BLOCKS + index;
+                klfs_alloc_hint = *start + count;
+                return true;
+            }
+        }
+        group = (group + 1) % sb->group_count;
+        from = 0;
+    }
+    return false;
+}
+
+// Claim a specific run, e.g. the blocks right after a file's last extent so
+// a growing file stays contiguous. Fails if any of them is taken.
+static bool klfs_alloc_at(klfs_superblock_t* sb, u32 start, u32 count) {
+    if(count == 0 || count > sb->free_blocks || start + count > sb->total_blocks) return false;
+
+    u32 index = start % KLFS_GROUP_BLOCKS;
+    if(index + count > KLFS_GROUP_BLOCKS) return false;
+    klfs_group_slot_t* slot = klfs_group_get(sb, start / KLFS_GROUP_BLOCKS);
+    if(!slot) return false;
+    for(u32 i = index; i < index + count; i++) {
+        if(klfs_busy(slot, i)) return false;
+    }
+    klfs_mark(slot, index, count, true);
+    sb->free_blocks -= count;
+    klfs_alloc_hint = start + count;
+    return true;
+}
+
+static void klfs_free_run(klfs_superblock_t* sb, u32 start, u32 count) {
+    if(start < sb->data_start || start + count > sb->total_blocks) return;
+    while(count > 0) {
+        u32 index = start % KLFS_GROUP_BLOCKS;
+        u32 piece = KLFS_GROUP_BLOCKS - index;
+        if(piece > count) piece = count;
+        klfs_group_slot_t* slot = klfs_group_get(sb, start / KLFS_GROUP_BLOCKS);
+        if(!slot) return;
+        sb->free_blocks += klfs_mark(slot, index, piece, false);
+        start += piece;
+        count -= piece;
+    }
+}
+
+// Write the group bitmaps that changed
+static bool klfs_bitmap_flush(klfs_superblock_t* sb) {
+    for(u32 i = 0; i < KLFS_GROUP_SLOTS; i++) {
+        if(klfs_groups[i].group != 0xFFFFFFFF && !klfs_group_flush(sb, &klfs_groups[i])) return false;
+    }
+    return true;
+}
+
+// Group bitmaps changed in memory and not yet written back
+static u32 klfs_groups_dirty(void) {
+    u32 dirty = 0;
+    for(u32 i = 0; i < KLFS_GROUP_SLOTS; i++) {
+        if(klfs_groups[i].group != 0xFFFFFFFF && klfs_groups[i].dirty) dirty++;
+    }
+    return dirty;
+}
+
+// After a journal commit the bitmaps in memory are what's committed
+static void klfs_groups_committed(void) {
+    for(u32 i = 0; i < KLFS_GROUP_SLOTS; i++) {
+        klfs_group_slot_t* slot = &klfs_groups[i];
+        if(slot->group == 0xFFFFFFFF) continue;
+        for(u32 w = 0; w < KLFS_BLOCK_SIZE / 4; w++) slot->base[w] = slot->bits[w];
+    }
+}
+
+// Metadata journal
+// Every metadata change (superblock, bitmap, directory, extent maps) happens
+// inside a transaction. A transaction's blocks collect in memory and join the
+// running group when it ends; nothing reaches its home location yet. The
+// group is committed in one go when it's close to full, or on klfs_sync:
+//   1. the descriptor (list of home blocks) and the block images go to the
+//      journal, and all cached data is written, then flushed
+//   2. the commit record is written and flushed
+//   3. the blocks are written home and flushed (the checkpoint)
+// A crash before 2 loses the whole group and leaves the old metadata intact;
+// a crash after it is repaired by replaying the journal at mount. The commit
+// record carries a checksum of the descriptor and images, so a half-written
+// journal left behind by the next group is never replayed. Data blocks
+// always reach the disk before the metadata pointing at them. Metadata reads
+// see the newest copy: the open transaction, then the group, then the disk.
+// Many small updates touching the same blocks (creating a batch of files
+// rewrites the superblock and a few directory blocks each time) cost one
+// journal write per group instead of a superblock write each.
+#define KLFS_JOURNAL_MAX     32  // Blocks per group commit
+#define KLFS_JOURNAL_BLOCKS  (KLFS_JOURNAL_MAX + 2)  // Plus descriptor and commit record
+#define KLFS_TX_MAX          16  // Blocks one transaction may touch
+#define KLFS_JOURNAL_DESC    0x4A444553  // "JDES"
+#define KLFS_JOURNAL_COMMIT  0x4A434D54  // "JCMT"
+
+typedef struct {
+    u32 magic;                     // KLFS_JOURNAL_DESC
+    u32 sequence;                  // Matches the commit record of the same group
+    u32 count;                     // Block images that follow
+    u32 blocks[KLFS_JOURNAL_MAX];  // Home location of each image
+    u8 reserved[1024 - 12 - KLFS_JOURNAL_MAX * 4];
+} klfs_journal_desc_t;
+
+typedef struct {
+    u32 magic;     // KLFS_JOURNAL_COMMIT
+    u32 sequence;
+    u32 count;
+    u32 checksum;  // Over the descriptor and the block images
+    u8 reserved[1008];
+} klfs_journal_commit_t;
+
+static u32 klfs_journal_start = 0;   // 0 = no journal, metadata is written straight home
+static u32 klfs_journal_seq = 1;
+static u32 klfs_jcount = 0;          // Blocks in the running group
+static u32 klfs_jblocks[KLFS_JOURNAL_MAX];
+static u8 klfs_jdata[KLFS_JOURNAL_MAX][KLFS_BLOCK_SIZE] __attribute__((aligned(KLFS_BLOCK_SIZE)));
+static bool klfs_tx_active = false;
+static u32 klfs_txcount = 0;         // Blocks in the open transaction
+static u32 klfs_txblocks[KLFS_TX_MAX];
+static u8 klfs_txdata[KLFS_TX_MAX][KLFS_BLOCK_SIZE];
+
+// Counters for verify
+static u32 klfs_journal_commits = 0;
+static u32 klfs_journal_written = 0;
+static u32 klfs_journal_updates = 0;
+
+static void klfs_zero(void* buffer, u32 size) {
+    for(u32 i = 0; i < size; i++) ((u8*)buffer)[i] = 0;
+}
+
+static void klfs_copy_block(void* dest, const void* src) {
+    u32* d = (u32*)dest;
+    const u32* s = (const u32*)src;
+    for(u32 i = 0; i < KLFS_BLOCK_SIZE / 4; i++) d[i] = s[i];
+}
+
+static u32 klfs_journal_checksum(const klfs_journal_desc_t* desc) {
+    u32 sum = desc->sequence;
+    const u32* words = (const u32*)desc;
+    for(u32 i = 0; i < KLFS_BLOCK_SIZE / 4; i++) sum = ((sum << 5) | (sum >> 27)) + words[i];
+    for(u32 b = 0; b < desc->count; b++) {
+        words = (const u32*)klfs_jdata[b];
+        for(u32 i = 0; i < KLFS_BLOCK_SIZE / 4; i++) sum = ((sum << 5) | (sum >> 27)) + words[i];
+    }
+    return sum;
+}
+
+static void klfs_journal_reset(void) {
+    klfs_jcount = 0;
+    klfs_txcount = 0;
+    klfs_tx_active = false;
+    klfs_journal_start = 0;
+}
+
+// Metadata cache
+// Directory blocks, bucket tables, the group table and extent maps are read
+// by nearly every command, and in the block cache they compete with file
+// data: one large cat pushes all of them out. So whatever klfs_meta_read
+// fetches from disk is also kept here, and every write to a block held here
+// (a checkpoint, or a data write to a reused block) updates the copy, which
+// is therefore always what the home location holds. The superblock isn't
+// cached here; it's held in klfs_super for as long as the disk is mounted.
+#define KLFS_MCACHE_BLOCKS 32
+
+typedef struct {
+    u32 block;        // Block held, 0 = free
+    bool referenced;  // Used since the clock hand last passed
+} klfs_mcache_entry_t;
+
+static klfs_mcache_entry_t klfs_mcache[KLFS_MCACHE_BLOCKS];
+static u8 klfs_mcache_data[KLFS_MCACHE_BLOCKS][KLFS_BLOCK_SIZE];
+static u32 klfs_mcache_hand = 0;
+static u32 klfs_mcache_hits = 0;
+static u32 klfs_mcache_misses = 0;
+
+static void klfs_mcache_drop(void) {
+    for(u32 i = 0; i < KLFS_MCACHE_BLOCKS; i++) klfs_mcache[i].block = 0;
+}
+
+static u8* klfs_mcache_find(u32 block) {
+    for(u32 i = 0; i < KLFS_MCACHE_BLOCKS; i++) {
+        if(klfs_mcache[i].block == block) {
+            klfs_mcache[i].referenced = true;
+            return klfs_mcache_data[i];
+        }
+    }
+    return 0;
+}
+
+// Keep a copy of a block just read, in place of one not used lately
+static void klfs_mcache_insert(u32 block, const void* data) {
+    while(klfs_mcache[klfs_mcache_hand].block && klfs_mcache[klfs_mcache_hand].referenced) {
+        klfs_mcache[klfs_mcache_hand].referenced = false;
+        klfs_mcache_hand = (klfs_mcache_hand + 1) % KLFS_MCACHE_BLOCKS;
+    }
+    klfs_mcache[klfs_mcache_hand].block = block;
+    klfs_mcache[klfs_mcache_hand].referenced = true;
+    klfs_copy_block(klfs_mcache_data[klfs_mcache_hand], data);
+    klfs_mcache_hand = (klfs_mcache_hand + 1) % KLFS_MCACHE_BLOCKS;
+}
+
+// Every block write comes through here
+static void klfs_mcache_update(u32 block_num, u32 count, const void* data) {
+    const u8* p = (const u8*)data;
+    if(block_num == 0) klfs_copy_block(&klfs_super, p);
+    for(u32 i = 0; i < KLFS_MCACHE_BLOCKS; i++) {
+        u32 block = klfs_mcache[i].block;
+        if(block && block >= block_num && block < block_num + count) {
+            klfs_copy_block(klfs_mcache_data[i], p + (block - block_num) * KLFS_BLOCK_SIZE);
+        }
+    }
+}
+
+static bool klfs_meta_read(u32 block, void* buffer) {
+    for(u32 i = 0; i < klfs_txcount; i++) {
+        if(klfs_txblocks[i] == block) {
+            klfs_copy_block(buffer, klfs_txdata[i]);
+            return true;
+        }
+    }
+    for(u32 i = 0; i < klfs_jcount; i++) {
+        if(klfs_jblocks[i] == block) {
+            klfs_copy_block(buffer, klfs_jdata[i]);
+            return true;
+        }
+    }
+    if(block == 0) {
+        if(!klfs_mounted) return read_block(0, buffer);
+        klfs_copy_block(buffer, &klfs_super);
+        return true;
+    }
+
+    u8* cached = klfs_mcache_find(block);
+    if(cached) {
+        klfs_mcache_hits++;
+        klfs_copy_block(buffer, cached);
+        return true;
+    }
+    if(!read_block(block, buffer)) return false;
+    klfs_mcache_misses++;
+    klfs_mcache_insert(block, buffer);
+    return true;
+}
+
+static bool klfs_meta_write(u32 block, const void* buffer) {
+    if(!klfs_tx_active) return write_block(block, (void*)buffer);
+
+    u32 i = 0;
+    while(i < klfs_txcount && klfs_txblocks[i] != block) i++;
+    if(i == KLFS_TX_MAX) {
+        kprint("Error: Transaction too large\n");
+        return false;
+    }
+    if(i == klfs_txcount) {
+        klfs_txblocks[klfs_txcount++] = block;
+    }
+    klfs_copy_block(klfs_txdata[i], buffer);
+    return true;
+}
+
+// Write the running group to the journal, commit it and checkpoint it.
+// On failure the group stays in memory so a later commit can retry.
+static bool klfs_journal_commit(void) {
+    klfs_journal_desc_t desc;
+    klfs_journal_commit_t commit;
+
+    if(klfs_jcount == 0) return true;
+
+    klfs_zero(&desc, sizeof(desc));
+    desc.magic = KLFS_JOURNAL_DESC;
+    desc.sequence = klfs_journal_seq;
+    desc.count = klfs_jcount;
+    for(u32 i = 0; i < klfs_jcount; i++) desc.blocks[i] = klfs_jblocks[i];
+
+    klfs_zero(&commit, sizeof(commit));
+    commit.magic = KLFS_JOURNAL_COMMIT;
+    commit.sequence = klfs_journal_seq;
+    commit.count = klfs_jcount;
+    commit.checksum = klfs_journal_checksum(&desc);
+
+    u32 commit_block = klfs_journal_start + 1 + KLFS_JOURNAL_MAX;
+    if(!write_block(klfs_journal_start, &desc) ||
+       !write_blocks(klfs_journal_start + 1, klfs_jcount, klfs_jdata) ||
+       !bcache_sync() ||
+       !write_block(commit_block, &commit) ||
+       !bcache_sync()) {
+        kprint("Error: Failed to write journal\n");
+        return false;
+    }
+
+    // Committed; now the home locations can be updated
+    for(u32 i = 0; i < klfs_jcount; i++) {
+        if(!write_block(klfs_jblocks[i], klfs_jdata[i])) {
+            kprint("Error: Failed to write metadata\n");
+            return false;
+        }
+    }
+    if(!bcache_sync()) {
+        kprint("Error: Failed to write metadata\n");
+        return false;
+    }
+
+    // Retire the commit record so the next mount doesn't replay this group
+    // again (harmless, but slow). It goes out with the next flush.
+    klfs_zero(&commit, sizeof(commit));
+    write_block(commit_block, &commit);
+
+    klfs_journal_commits++;
+    klfs_journal_written += klfs_jcount;
+    klfs_journal_seq++;
+    klfs_jcount = 0;
+    klfs_groups_committed();
+    return true;
+}
+
+// Start a transaction, committing the group first if it might not have room
+static bool klfs_tx_begin(void) {
+    if(klfs_jcount + KLFS_TX_MAX > KLFS_JOURNAL_MAX && !klfs_journal_commit()) return false;
+    klfs_txcount = 0;
+    klfs_tx_active = true;
+    return true;
+}
+
+// Move the transaction's blocks into the running group
+static void klfs_tx_end(void) {
+    for(u32 t = 0; t < klfs_txcount; t++) {
+        u32 i = 0;
+        while(i < klfs_jcount && klfs_jblocks[i] != klfs_txblocks[t]) i++;
+        if(i == klfs_jcount) klfs_jblocks[klfs_jcount++] = klfs_txblocks[t];
+        klfs_copy_block(klfs_jdata[i], klfs_txdata[t]);
+    }
+    klfs_txcount = 0;
+    klfs_tx_active = false;
+    klfs_journal_updates++;
+}
+
+// Throw the transaction away. The group bitmaps in memory may have
+// allocations from it, so they're reloaded (from the group or disk) on next use.
+static void klfs_tx_abort(void) {
+    klfs_txcount = 0;
+    klfs_tx_active = false;
+    klfs_groups_drop();
+}
+
+// Replay the last group if its commit record made it to disk
+static bool klfs_journal_replay(klfs_superblock_t* sb) {
+    klfs_journal_desc_t desc;
+    klfs_journal_commit_t commit;
+    u32 commit_block = sb->journal_start + 1 + KLFS_JOURNAL_MAX;
+
+    if(!read_block(sb->journal_start, &desc) || !read_block(commit_block, &commit)) {
+        kprint("Error: Failed to read journal\n");
+        return false;
+    }
+    klfs_journal_seq = (desc.magic == KLFS_JOURNAL_DESC) ? desc.sequence + 1 : 1;
+
+    if(desc.magic != KLFS_JOURNAL_DESC || commit.magic != KLFS_JOURNAL_COMMIT ||
+       desc.sequence != commit.sequence || desc.count != commit.count ||
+       desc.count == 0 || desc.count > KLFS_JOURNAL_MAX) {
+        return true;  // Nothing committed that wasn't checkpointed
+    }
+
+    if(!read_blocks(sb->journal_start + 1, desc.count, klfs_jdata)) {
+        kprint("Error: Failed to read journal\n");
+        return false;
+    }
+    if(klfs_journal_checksum(&desc) != commit.checksum) {
+        return true;  // Torn by a later group that never committed
+    }
+    for(u32 i = 0; i < desc.count; i++) {
+        if(!write_block(desc.blocks[i], klfs_jdata[i])) {
+            kprint("Error: Failed to replay journal\n");
+            return false;
+        }
+    }
+    if(!bcache_sync()) {
+        kprint("Error: Failed to replay journal\n");
+        return false;
+    }
+    klfs_zero(&commit, sizeof(commit));
+    write_block(commit_block, &commit);
+
+    kprint("KLFS: replayed "); kprint_dec(desc.count); kprint(" metadata blocks from the journal\n");
+    return true;
+}
+
+// Commit any pending metadata and flush everything to disk
+bool klfs_sync(void) {
+    return klfs_journal_commit() && bcache_sync();
+}
+
+// Background flush
+// The kernel's main loop calls klfs_flush between commands every
+// KLFS_FLUSH_SECONDS (see kernel.c). So updates waiting in the running
+// journal group and dirty cached data reach the disk within a few seconds
+// without anyone running sync, while commands themselves never wait for a
+// commit they don't need.
+static u32 klfs_flushes = 0;  // For verify
+
+bool klfs_flush(void) {
+    if(!klfs_mounted || klfs_tx_active) return true;
+    if(klfs_jcount == 0 && bcache_dirty() == 0) return true;
+    klfs_flushes++;
+    return klfs_sync();
+}
+
+// Shared blocks
+// cp doesn't copy data: the new file gets its own extent map pointing at the
+// same blocks, and each block's reference count goes up. The counts live in
+// each group's metadata, one byte per block of the group, holding the number of references
+// beyond the first, so unshared blocks (the usual case) read as 0 and a
+// disk that never used cp never has to look at the table. Files that may
+// share blocks are flagged; before such a file writes to a block, the block
+// is checked and, if shared, replaced by a private copy (copy-on-write).
+// Freeing a shared block just drops one reference.
+#define KLFS_MAX_REFS 255
+
+// Walks a run of blocks with the right refcount table block loaded, writing
+// each table block back when the walk moves past it
+typedef struct {
+    u32 table_block;  // Loaded table block, or 0xFFFFFFFF
+    bool dirty;
+    u8 refs[KLFS_REFS_PER_BLOCK];
+} klfs_refwalk_t;
+
+static bool klfs_ref_put(klfs_refwalk_t* walk) {
+    if(walk->table_block == 0xFFFFFFFF || !walk->dirty) return true;
+    if(!klfs_meta_write(walk->table_block, walk->refs)) {
+        kprint("Error: Failed to write reference counts\n");
+        return false;
+    }
+    walk->dirty = false;
+    return true;
+}
+
+static u8* klfs_ref_get(klfs_superblock_t* sb, klfs_refwalk_t* walk, u32 block) {
+    u32 index = block % KLFS_GROUP_BLOCKS;
+    u32 table_block = klfs_group_meta(sb, block / KLFS_GROUP_BLOCKS) + 1 + index / KLFS_REFS_PER_BLOCK;
+    if(table_block != walk->table_block) {
+        if(!klfs_ref_put(walk)) return 0;
+        if(!klfs_meta_read(table_block, walk->refs)) {
+            kprint("Error: Failed to read reference counts\n");
+            return 0;
+        }
+        walk->table_block = table_block;
+    }
+    return &walk->refs[index % KLFS_REFS_PER_BLOCK];
+}
+
+static void klfs_refwalk_init(klfs_refwalk_t* walk) {
+    walk->table_block = 0xFFFFFFFF;
+    walk->dirty = false;
+}
+
+// Add a reference to every block in a run
+static bool klfs_share_run(klfs_superblock_t* sb, klfs_refwalk_t* walk, u32 start, u32 count) {
+    for(u32 block = start; block < start + count; block++) {
+        u8* ref = klfs_ref_get(sb, walk, block);
+        if(!ref) return false;
+        if(*ref == KLFS_MAX_REFS) return false;  // The caller copies the data instead
+        (*ref)++;
+        walk->dirty = true;
+        sb->shared_blocks++;
+    }
+    return true;
+}
+
+// Drop a reference to every block in a run, freeing the ones nobody else uses
+static bool klfs_release_run(klfs_superblock_t* sb, u32 start, u32 count) {
+    if(sb->shared_blocks == 0) {
+        klfs_free_run(sb, start, count);
+        return true;
+    }
+
+    klfs_refwalk_t walk;
+    klfs_refwalk_init(&walk);
+    for(u32 block = start; block < start + count; block++) {
+        u8* ref = klfs_ref_get(sb, &walk, block);
+        if(!ref) return false;
+        if(*ref) {
+            (*ref)--;
+            walk.dirty = true;
+            sb->shared_blocks--;
+        } else {
+            klfs_free_run(sb, block, 1);
+        }
+    }
+    return klfs_ref_put(&walk);
+}
+
+// Disk blocks behind an extent
+static u32 klfs_extent_disk(const klfs_extent_t* ext) {
+    return ext->stored ? ext->stored : ext->count;
+}
+
+// Directory
+// Names are hashed into a fixed number of buckets chosen at format time. The
+// superblock points at the directory root, a block of pointers to bucket
+// tables; each bucket table is a block of pointers to the first directory
+// block of 256 buckets, and a bucket that fills up chains on another directory
+// block. With the bucket count scaled to the disk, a lookup reads the root, one
+// table and (almost always) one directory block, however many files there are.
+// Tables and buckets are only allocated the first time a name hashes into them.
+#define KLFS_PTRS_PER_BLOCK (KLFS_BLOCK_SIZE / 4)
+#define KLFS_MIN_BUCKETS    16
+#define KLFS_MAX_BUCKETS    (KLFS_PTRS_PER_BLOCK * KLFS_PTRS_PER_BLOCK)
+#define KLFS_BLOCKS_PER_BUCKET 64  // One bucket per this many disk blocks
+
+// Where an entry lives, so it can be updated or removed without another lookup
+typedef struct {
+    u32 block;
+    u32 index;
+} klfs_dir_pos_t;
+
+typedef void (*klfs_dir_visit_t)(const klfs_file_entry_t* entry, void* context);
+
+// FNV-1a over the part of the name that gets stored
+static u32 klfs_hash(const char* name) {
+    u32 hash = 2166136261u;
+    for(u32 i = 0; i < 31 && name[i]; i++) {
+        hash ^= (u8)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Names are stored truncated to 31 characters, so compare only that much
+static bool klfs_name_matches(const char* stored, const char* name) {
+    for(u32 i = 0; i < 31; i++) {
+        if(stored[i] != name[i]) return false;
+        if(!name[i]) return true;
+    }
+    return true;
+}
+
+// Allocate a metadata block and write it out zeroed
+static bool klfs_new_block(klfs_superblock_t* sb, u32* block) {
+    u8 zero[KLFS_BLOCK_SIZE];
+    klfs_zero(zero, sizeof(zero));
+    if(!klfs_alloc_run(sb, 1, block)) {
+        kprint("Error: Not enough free space\n");
+        return false;
+    }
+    if(!klfs_meta_write(*block, zero)) {
+        kprint("Error: Failed to write directory block\n");
+        return false;
+    }
+    return true;
+}
+
+// Read the bucket table that covers a name's bucket. *table is set to 0 when
+// the table doesn't exist yet; with create set, it gets allocated instead.
+static bool klfs_dir_table(klfs_superblock_t* sb, u32 bucket, bool create, u32* table, u32* pointers) {
+    u32 root[KLFS_PTRS_PER_BLOCK];
+
+    *table = 0;
+    if(!klfs_meta_read(sb->dir_root, root)) {
+        kprint("Error: Failed to read directory\n");
+        return false;
+    }
+    u32 slot = bucket / KLFS_PTRS_PER_BLOCK;
+    if(root[slot] == 0) {
+        if(!create) return true;
+        if(!klfs_new_block(sb, &root[slot])) return false;
+        if(!klfs_meta_write(sb->dir_root, root)) {
+            kprint("Error: Failed to write directory\n");
+            return false;
+        }
+    }
+    *table = root[slot];
+    if(!klfs_meta_read(*table, pointers)) {
+        kprint("Error: Failed to read directory\n");
+        return false;
+    }
+    return true;
+}
+
+// Find a file by name. Returns false if it doesn't exist (or the directory
+// can't be read, which is reported here).
+static bool klfs_lookup(klfs_superblock_t* sb, const char* name, klfs_file_entry_t* entry, klfs_dir_pos_t* pos) {
+    u32 bucket = klfs_hash(name) & (sb->dir_buckets - 1);
+    u32 table, pointers[KLFS_PTRS_PER_BLOCK];
+
+    if(!klfs_dir_table(sb, bucket, false, &table, pointers) || table == 0) return false;
+
+    u32 block = pointers[bucket % KLFS_PTRS_PER_BLOCK];
+    while(block) {
+        klfs_dir_block_t dir;
+        if(!klfs_meta_read(block, &dir)) {
+            kprint("Error: Failed to read directory\n");
+            return false;
+        }
+        for(u32 i = 0; i < KLFS_DIR_ENTRIES; i++) {
+            if(dir.entries[i].used && klfs_name_matches(dir.entries[i].name, name)) {
+                *entry = dir.entries[i];
+                if(pos) {
+                    pos->block = block;
+                    pos->index = i;
+                }
+                return true;
+            }
+        }
+        block = dir.next;
+    }
+    return false;
+}
+
+// Add an entry to its bucket, reusing the first free slot in the chain or
+// chaining a new directory block onto the end. The caller writes back the
+// bitmap and superblock afterwards.
+static bool klfs_dir_insert(klfs_superblock_t* sb, const klfs_file_entry_t* entry) {
+    u32 bucket = klfs_hash(entry->name) & (sb->dir_buckets - 1);
+    u32 table, pointers[KLFS_PTRS_PER_BLOCK];
+    klfs_dir_block_t dir;
+
+    if(!klfs_dir_table(sb, bucket, true, &table, pointers)) return false;
+
+    u32 block = pointers[bucket % KLFS_PTRS_PER_BLOCK];
+    u32 last = 0;
+    while(block) {
+        if(!klfs_meta_read(block, &dir)) {
+            kprint("Error: Failed to read directory\n");
+            return false;
+        }
+        if(dir.count < KLFS_DIR_ENTRIES) {
+            for(u32 i = 0; i < KLFS_DIR_ENTRIES; i++) {
+                if(dir.entries[i].used) continue;
+                dir.entries[i] = *entry;
+                dir.count++;
+                if(!klfs_meta_write(block, &dir)) {
+                    kprint("Error: Failed to write directory\n");
+                    return false;
+                }
+                return true;
+            }
+        }
+        last = block;
+        block = dir.next;
+    }
+
+    // Every block in the bucket is full. The new block is written before it
+    // is linked in, so the chain never points at garbage.
+    u32 new_block;
+    if(!klfs_alloc_run(sb, 1, &new_block)) {
+        kprint("Error: Not enough free space\n");
+        return false;
+    }
+    klfs_zero(&dir, sizeof(dir));
+    dir.entries[0] = *entry;
+    dir.count = 1;
+    if(!klfs_meta_write(new_block, &dir)) {
+        kprint("Error: Failed to write directory\n");
+        return false;
+    }
+
+    if(last == 0) {
+        pointers[bucket % KLFS_PTRS_PER_BLOCK] = new_block;
+        if(!klfs_meta_write(table, pointers)) {
+            kprint("Error: Failed to write directory\n");
+            return false;
+        }
+    } else {
+        if(!klfs_meta_read(last, &dir)) {
+            kprint("Error: Failed to read directory\n");
+            return false;
+        }
+        dir.next = new_block;
+        if(!klfs_meta_write(last, &dir)) {
+            kprint("Error: Failed to write directory\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Rewrite (or, with entry 0, clear) the entry at a known position. Emptied
+// blocks stay in their chain and get reused by the next insert.
+static bool klfs_dir_store(const klfs_dir_pos_t* pos, const klfs_file_entry_t* entry) {
+    klfs_dir_block_t dir;
+
+    if(!klfs_meta_read(pos->block, &dir)) {
+        kprint("Error: Failed to read directory\n");
+        return false;
+    }
+    if(entry) {
+        dir.entries[pos->index] = *entry;
+    } else {
+        klfs_zero(&dir.entries[pos->index], sizeof(klfs_file_entry_t));
+        dir.count--;
+    }
+    if(!klfs_meta_write(pos->block, &dir)) {
+        kprint("Error: Failed to write directory\n");
+        return false;
+    }
+    return true;
+}
+
+// Call visit for every file, in hash order
+static bool klfs_dir_walk(klfs_superblock_t* sb, klfs_dir_visit_t visit, void* context) {
+    u32 root[KLFS_PTRS_PER_BLOCK];
+    u32 tables = (sb->dir_buckets + KLFS_PTRS_PER_BLOCK - 1) / KLFS_PTRS_PER_BLOCK;
+    u32 per_table = sb->dir_buckets < KLFS_PTRS_PER_BLOCK ? sb->dir_buckets : KLFS_PTRS_PER_BLOCK;
+
+    if(!klfs_meta_read(sb->dir_root, root)) {
+        kprint("Error: Failed to read directory\n");
+        return false;
+    }
+    for(u32 t = 0; t < tables; t++) {
+        u32 pointers[KLFS_PTRS_PER_BLOCK];
+        if(root[t] == 0) continue;
+        if(!klfs_meta_read(root[t], pointers)) {
+            kprint("Error: Failed to read directory\n");
+            return false;
+        }
+        for(u32 b = 0; b < per_table; b++) {
+            u32 block = pointers[b];
+            while(block) {
+                klfs_dir_block_t dir;
+                if(!klfs_meta_read(block, &dir)) {
+                    kprint("Error: Failed to read directory\n");
+                    return false;
+                }
+                for(u32 i = 0; i < KLFS_DIR_ENTRIES; i++) {
+                    if(dir.entries[i].used) visit(&dir.entries[i], context);
+                }
+                block = dir.next;
+            }
+        }
+    }
+    return true;
+}
+
+// Mount the root disk: read and check the superblock and replay the journal
+// if it holds a committed group. The superblock then stays in klfs_super,
+// which every write of block 0 keeps up to date (the replay's included).
+static bool klfs_mount_disk(void) {
+    klfs_superblock_t* sb = &klfs_super;
+
+    klfs_journal_reset();
+    klfs_mcache_drop();
+    if(!read_block(0, sb)) {
+        kprint("Error: Failed to read superblock\n");
+        return false;
+    }
+    if(sb->magic != KLFS_MAGIC) {
+        kprint("Error: Not a KLFS filesystem\n");
+        return false;
+    }
+    if(sb->dir_root == 0 || sb->dir_buckets == 0 || sb->journal_blocks != KLFS_JOURNAL_BLOCKS ||
+       sb->group_blocks != KLFS_GROUP_BLOCKS || sb->group_meta != KLFS_GROUP_META) {
+        kprint("Error: Old KLFS layout, run format\n");
+        return false;
+    }
+
+    klfs_csum_setup(sb);  // Before the replay, so it updates checksums too
+    if(!klfs_journal_replay(sb)) return false;
+    klfs_journal_start = klfs_super.journal_start;
+    klfs_groups_drop();
+    klfs_alloc_hint = klfs_super.data_start;
+    klfs_mounted = true;
+    return true;
+}
+
+// Get a copy of the superblock to work on, as changed by the open
+// transaction or the running journal group if they have. It comes from
+// memory; only the first call after boot or a disk switch goes to the disk,
+// to mount it.
+static bool klfs_load_super(klfs_superblock_t* sb) {
+    if(!klfs_mounted && !klfs_mount_disk()) return false;
+    return klfs_meta_read(0, sb);
+}
+
+// Write back the changed bitmap blocks, then the superblock
+static bool klfs_store_super(klfs_superblock_t* sb) {
+    if(!klfs_bitmap_flush(sb) || !klfs_meta_write(0, sb)) {
+        kprint("Error: Failed to update superblock\n");
+        return false;
+    }
+    return true;
+}
+
+// Simple KLFS format
+// KLFS format with proper magic number. blocks = 0 uses the whole disk, as
+// measured by the driver (IDENTIFY for ATA).
+void klfs_format(u32 blocks) {
+    klfs_superblock_t sb = {0};
+    blkdev_t* dev = blkdev_root();
+    if(!dev) {
+        kprint("Error: No disk\n");
+        return;
+    }
+
+    u64 capacity = dev->sectors / (KLFS_BLOCK_SIZE / 512);
+    if(capacity > 0xFFFFFFFF) capacity = 0xFFFFFFFF;
+    if(blocks == 0) blocks = (u32)capacity;
+    if(blocks > capacity) {
+        kprint("Error: Disk only has "); kprint_dec((u32)capacity); kprint(" blocks\n");
+        return;
+    }
+    if(blocks < KLFS_MIN_BLOCKS) {
+        kprint("Error: Need at least "); kprint_dec(KLFS_MIN_BLOCKS); kprint(" blocks\n");
+        return;
+    }
+
+    // A last group too small for its own metadata is left unused
+    u32 tail = blocks % KLFS_GROUP_BLOCKS;
+    if(blocks > KLFS_GROUP_BLOCKS && tail > 0 && tail <= KLFS_GROUP_META) blocks -= tail;
+
+    sb.magic = KLFS_MAGIC;
+    sb.total_blocks = blocks;
+    sb.group_blocks = KLFS_GROUP_BLOCKS;
+    sb.group_meta = KLFS_GROUP_META;
+    sb.group_count = (blocks + KLFS_GROUP_BLOCKS - 1) / KLFS_GROUP_BLOCKS;
+    sb.dir_root = 1;
+    sb.journal_start = sb.dir_root + 1;
+    sb.journal_blocks = KLFS_JOURNAL_BLOCKS;
+    sb.group_table = sb.journal_start + sb.journal_blocks;
+    sb.data_start = sb.group_table + (sb.group_count + KLFS_GROUPS_PER_TABLE_BLOCK - 1) / KLFS_GROUPS_PER_TABLE_BLOCK;
+    sb.file_count = 0;
+
+    // Roughly one bucket per KLFS_BLOCKS_PER_BUCKET blocks keeps the chains
+    // one block long until the disk is mostly small files
+    sb.dir_buckets = KLFS_MIN_BUCKETS;
+    while(sb.dir_buckets < KLFS_MAX_BUCKETS && sb.dir_buckets * KLFS_BLOCKS_PER_BUCKET < sb.total_blocks) {
+        sb.dir_buckets <<= 1;
+    }
+
+    // Anything pending was for the old filesystem; with no journal set up
+    // the writes below go straight home
+    klfs_journal_reset();
+    klfs_groups_drop();
+    klfs_mcache_drop();
+    klfs_chunk_forget();
+
+    // No checksums recorded yet; each block written from here on gets one
+    u8 zero[KLFS_BLOCK_SIZE];
+    klfs_zero(zero, sizeof(zero));
+    klfs_csum_setup(&sb);
+    for(u32 group = 0; group < sb.group_count; group++) {
+        u32 sums = klfs_group_meta(&sb, group) + 1 + KLFS_REF_BLOCKS;
+        for(u32 i = 0; i < KLFS_SUM_BLOCKS; i++) write_block(sums + i, zero);
+    }
+
+    // Empty directory (no bucket tables yet) and an empty journal
+    write_block(sb.dir_root, zero);
+    write_block(sb.journal_start, zero);
+    write_block(sb.journal_start + 1 + KLFS_JOURNAL_MAX, zero);
+
+    // Each group's bitmap has its metadata (and for group 0 the global
+    // metadata) in use, and so are any bits past the end of the disk
+    u32 table[KLFS_GROUPS_PER_TABLE_BLOCK];
+    u32 bits[KLFS_BLOCK_SIZE / 4];
+    sb.free_blocks = 0;
+    for(u32 group = 0; group < sb.group_count; group++) {
+        u32 first = group * KLFS_GROUP_BLOCKS;
+        u32 meta_end = klfs_group_meta(&sb, group) + KLFS_GROUP_META;
+        u32 free = 0;
+        klfs_zero(bits, sizeof(bits));
+        for(u32 i = 0; i < KLFS_GROUP_BLOCKS; i++) {
+            if(first + i < meta_end || first + i >= blocks) {
+                bits[i / 32] |= 1u << (i % 32);
+            } else {
+                free++;
+            }
+        }
+        write_block(klfs_group_meta(&sb, group), bits);
+        for(u32 i = 0; i < KLFS_REF_BLOCKS; i++) write_block(klfs_group_meta(&sb, group) + 1 + i, zero);
+
+        table[group % KLFS_GROUPS_PER_TABLE_BLOCK] = free;
+        if(group % KLFS_GROUPS_PER_TABLE_BLOCK == KLFS_GROUPS_PER_TABLE_BLOCK - 1 || group == sb.group_count - 1) {
+            write_block(sb.group_table + group / KLFS_GROUPS_PER_TABLE_BLOCK, table);
+            klfs_zero(table, sizeof(table));
+        }
+        sb.free_blocks += free;
+    }
+
+    write_block(0, &sb);
+    bcache_sync();
+
+    klfs_journal_start = sb.journal_start;
+    klfs_journal_seq = 1;
+    klfs_alloc_hint = sb.data_start;
+    klfs_mounted = true;
+    kprint("KLFS formatted: "); kprint_dec(sb.total_blocks); kprint(" blocks in ");
+    kprint_dec(sb.group_count); kprint(sb.group_count == 1 ? " group\n" : " groups\n");
+}
+
+// Scratch space for moving many blocks at once: the scrub below, grep, and
+// cp when it has to copy data. None of them runs inside another.
+#define KLFS_SCRATCH_BLOCKS 16
+static u8 klfs_scratch[KLFS_SCRATCH_BLOCKS * KLFS_BLOCK_SIZE];
+
+// Print the time taken and the rate, as "1.25 s, 80.0 MB/s"
+static void klfs_print_rate(u32 kb, u32 ticks) {
+    if(ticks == 0) ticks = 1;
+    u32 hundredths = ticks * 100 / TIMER_HZ;
+    u32 tenths_mb = ((kb / 1024) * TIMER_HZ * 10 + (kb % 1024) * TIMER_HZ * 10 / 1024) / ticks;
+
+    kprint_dec(hundredths / 100); kprint(".");
+    if(hundredths % 100 < 10) kprint("0");
+    kprint_dec(hundredths % 100); kprint(" s, ");
+    kprint_dec(tenths_mb / 10); kprint("."); kprint_dec(tenths_mb % 10); kprint(" MB/s");
+}
+
+// Scrub: read every block in use and check it against its checksum
+// The point is to check the media, so everything pending is written out first
+// and the blocks are then read straight from the disk, around the block cache,
+// which would otherwise hand back its own (trivially matching) copy.
+
+static bool klfs_scrub(klfs_superblock_t* sb) {
+    u32 checked = 0, unreadable = 0;
+    u32 errors = klfs_csum_errors;
+    u32 start = timer_ticks;
+
+    if(!klfs_sync()) {
+        kprint("Error: Failed to write back before scrubbing\n");
+        return false;
+    }
+
+    for(u32 group = 0; group < sb->group_count; group++) {
+        klfs_group_slot_t* slot = klfs_group_get(sb, group);
+        if(!slot) return false;
+        u32 first = group * KLFS_GROUP_BLOCKS;
+        u32 end = KLFS_GROUP_BLOCKS;
+        if(first + end > sb->total_blocks) end = sb->total_blocks - first;
+
+        u32 i = 0;
+        while(i < end) {
+            if(!klfs_bit(slot->bits, i) || !klfs_csum_covered(first + i)) {
+                i++;
+                continue;
+            }
+            u32 run = 1;
+            while(run < KLFS_SCRATCH_BLOCKS && i + run < end && klfs_bit(slot->bits, i + run) &&
+                  klfs_csum_covered(first + i + run)) {
+                run++;
+            }
+
+            if(!read_sectors((u64)(first + i) * 2, run * 2, klfs_scratch)) {
+                kprint("Error: Failed to read block "); kprint_dec(first + i); kprint("\n");
+                unreadable += run;
+            } else {
+                for(u32 j = 0; j < run; j++) {
+                    klfs_csum_check(first + i + j, 1, klfs_scratch + j * KLFS_BLOCK_SIZE);
+                }
+            }
+            checked += run;
+            i += run;
+        }
+    }
+
+    kprint("Scrub: "); kprint_dec(checked); kprint(" blocks in ");
+    klfs_print_rate(checked, timer_ticks - start);
+    kprint(crc32c_hardware() ? ", SSE4.2 crc32" : ", slice-by-8");
+    kprint("\n");
+    kprint("Checksums: "); kprint_dec(klfs_csum_errors - errors); kprint(" bad, ");
+    kprint_dec(unreadable); kprint(" unreadable");
+    bool clean = klfs_csum_errors == errors && unreadable == 0;
+    kprint(clean ? " (all blocks in use match)\n" : " (see errors above)\n");
+    return clean;
+}
+
+static void klfs_count_visit(const klfs_file_entry_t* entry, void* context) {
+    (void)entry;
+    (*(u32*)context)++;
+}
+
+bool klfs_verify() {
+    u8 block[1024];
+    bool ok = false;
+    
+    if(read_block(0, block)) {
+        u32 magic = *(u32*)block;
+        if(magic == 0x4B4C4653) {
+            kprint("KLFS filesystem detected! Magic: ");
+            kprint_hex(magic >> 24); kprint_hex(magic >> 16); 
+            kprint_hex(magic >> 8); kprint_hex(magic & 0xFF);
+            kprint("\n");
+
+            // Cross-check the bitmap and directory against the superblock
+            klfs_superblock_t* sb = (klfs_superblock_t*)block;
+            if(klfs_load_super(sb)) {
+                ok = true;
+                u32 free = 0, bad_groups = 0;
+                for(u32 group = 0; group < sb->group_count; group++) {
+                    klfs_group_slot_t* slot = klfs_group_get(sb, group);
+                    if(!slot) return false;
+                    u32 group_free = 0;
+                    for(u32 i = 0; i < KLFS_GROUP_BLOCKS; i++) {
+                        if(!klfs_bit(slot->bits, i)) group_free++;
+                    }
+                    if(group_free != slot->free) bad_groups++;
+                    free += group_free;
+                }
+                kprint("Free blocks: "); kprint_dec(free);
+                kprint(free == sb->free_blocks ? " (bitmap matches superblock)\n" : " (bitmap and superblock disagree!)\n");
+                ok = ok && free == sb->free_blocks && bad_groups == 0;
+                kprint("Groups: "); kprint_dec(sb->group_count); kprint(" of ");
+                kprint_dec(KLFS_GROUP_BLOCKS); kprint(" blocks");
+                kprint(bad_groups == 0 ? " (bitmaps match group table)\n" : " (bitmaps and group table disagree!)\n");
+
+                u32 files = 0;
+                if(klfs_dir_walk(sb, klfs_count_visit, &files)) {
+                    kprint("Files: "); kprint_dec(files);
+                    kprint(" in "); kprint_dec(sb->dir_buckets); kprint(" buckets");
+                    kprint(files == sb->file_count ? " (directory matches superblock)\n" : " (directory and superblock disagree!)\n");
+                    ok = ok && files == sb->file_count;
+                } else {
+                    ok = false;
+                }
+
+                kprint("Shared block references: "); kprint_dec(sb->shared_blocks); kprint("\n");
+
+                kprint("Journal: "); kprint_dec(klfs_journal_updates); kprint(" updates in ");
+                kprint_dec(klfs_journal_commits); kprint(" commits ("); kprint_dec(klfs_journal_written);
+                kprint(" blocks), "); kprint_dec(klfs_jcount); kprint(" blocks pending, ");
+                kprint_dec(klfs_flushes); kprint(" timer flushes\n");
+                kprint("Metadata cache: "); kprint_dec(klfs_mcache_hits); kprint(" hits, ");
+                kprint_dec(klfs_mcache_misses); kprint(" misses\n");
+
+                ok = klfs_scrub(sb) && ok;
+            }
+        } else {
+            kprint("No KLFS filesystem found. Magic: ");
+            kprint_hex(magic >> 24); kprint_hex(magic >> 16);
+            kprint_hex(magic >> 8); kprint_hex(magic & 0xFF);
+            kprint("\n");
+        }
+    } else {
+        kprint("Failed to read block 0\n");
+    }
+    return ok;
+}
+
+static void klfs_list_visit(const klfs_file_entry_t* file, void* context) {
+    (void)context;
+
+    // Disk blocks used, fewer than the file's blocks when it's compressed
+    // or has holes
+    u32 stored = file->block_count;
+    if(file->flags & (KLFS_FILE_COMPRESSED | KLFS_FILE_SPARSE)) {
+        klfs_extent_map_t map;
+        if(file->extent_block == 0) {
+            stored = 0;
+        } else if(klfs_meta_read(file->extent_block, &map)) {
+            stored = 0;
+            for(u32 i = 0; i < map.count; i++) stored += klfs_extent_disk(&map.extents[i]);
+        }
+    }
+
+    // Print filename, truncated to 19 chars if needed
+    u32 name_len = 0;
+    while(file->name[name_len] && name_len < 32) name_len++;
+    
+    if(name_len > 19) {
+        // Print first 16 chars + "..."
+        for(u32 j = 0; j < 16; j++) {
+            char str[2] = {file->name[j], '\0'};
+            kprint(str);
+        }
+        kprint("...");
+        name_len = 19;
+    } else {
+        kprint(file->name);
+    }
+    
+    // Pad to 20 characters total
+    for(u32 j = name_len; j < 20; j++) kprint(" ");
+    
+    kprint_dec(file->size);
+    kprint("      ");
+    kprint_dec(file->block_count);
+    kprint("      ");
+    kprint_dec(stored);
+    if(file->flags & KLFS_FILE_COMPRESSED) kprint(" (compressed)");
+    kprint("\n");
+}
+
+void klfs_list_files() {
+    klfs_superblock_t sb;
+    
+    if(!klfs_load_super(&sb)) return;
+    
+    kprint("Files in KLFS:\n");
+    kprint("Name                Size     Blocks   Stored\n");
+    kprint("-------------------------------------------\n");
+    
+    if(sb.file_count == 0) {
+        kprint("(no files)\n");
+        return;
+    }
+    
+    if(!klfs_dir_walk(&sb, klfs_list_visit, 0)) return;
+    
+    kprint("\nTotal files: ");
+    kprint_dec(sb.file_count);
+    kprint(", Free blocks: ");
+    kprint_dec(sb.free_blocks);
+    kprint("\n");
+}
+
+// Copy filename (safely)
+static void klfs_set_name(klfs_file_entry_t* file, const char* filename) {
+    u32 j;
+    for(j = 0; j < 31 && filename[j]; j++) {
+        file->name[j] = filename[j];
+    }
+    for(; j < 32; j++) file->name[j] = '\0';
+}
+
+// Add an empty file. Errors are reported here.
+static bool klfs_create(klfs_superblock_t* sb, const char* filename) {
+    klfs_file_entry_t file;
+    
+    // Check if file already exists
+    if(klfs_lookup(sb, filename, &file, 0)) {
+        kprint("Error: File already exists\n");
+        return false;
+    }
+    
+    klfs_zero(&file, sizeof(file));
+    klfs_set_name(&file, filename);
+    file.used = 1;  // No data blocks yet
+    
+    if(!klfs_tx_begin()) return false;
+    sb->file_count++;
+    if(!klfs_dir_insert(sb, &file) || !klfs_store_super(sb)) {
+        klfs_tx_abort();  // Drops any blocks the directory allocated
+        return false;
+    }
+    klfs_tx_end();
+    return true;
+}
+
+bool klfs_create_file(const char* filename) {
+    klfs_superblock_t sb;
+    
+    if(!klfs_load_super(&sb) || !klfs_create(&sb, filename)) return false;
+    
+    kprint("File created: "); kprint(filename); kprint("\n");
+    return true;
+}
+
+// Compression
+// An LZSS codec, cheap enough to run on every write. The output is a flag
+// byte announcing the next eight items (bit set = match), then the items: a
+// literal byte, or a two-byte match of a 12-bit distance back into the
+// output and a 4-bit length. Matches are found through a hash table of the
+// last position each three-byte prefix was seen at, so compression is a
+// single pass with no searching.
+#define KLFS_LZ_MIN       3     // Shortest match worth encoding
+#define KLFS_LZ_MAX       18    // Longest match the length field holds
+#define KLFS_LZ_WINDOW    4095  // Furthest match distance
+#define KLFS_LZ_HASH_BITS 12
+
+static u16 klfs_lz_table[1 << KLFS_LZ_HASH_BITS];  // Position + 1 of each prefix, 0 = unseen
+
+static u32 klfs_lz_hash(const u8* p) {
+    u32 v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - KLFS_LZ_HASH_BITS);
+}
+
+// Compress length bytes (at most 64 KB) into out. Returns the compressed
+// length, or 0 if it would exceed limit.
+static u32 klfs_lz_compress(const u8* in, u32 length, u8* out, u32 limit) {
+    for(u32 i = 0; i < (1 << KLFS_LZ_HASH_BITS); i++) klfs_lz_table[i] = 0;
+
+    u32 ip = 0, op = 0, flag_pos = 0, bit = 8;
+    while(ip < length) {
+        if(bit == 8) {
+            if(op >= limit) return 0;
+            flag_pos = op;
+            out[op++] = 0;
+            bit = 0;
+        }
+
+        u32 match = 0, distance = 0;
+        if(ip + KLFS_LZ_MIN <= length) {
+            u32 h = klfs_lz_hash(in + ip);
+            u32 candidate = klfs_lz_table[h];
+            klfs_lz_table[h] = ip + 1;
+            if(candidate && ip - (candidate - 1) <= KLFS_LZ_WINDOW) {
+                const u8* from = in + candidate - 1;
+                u32 max = length - ip;
+                if(max > KLFS_LZ_MAX) max = KLFS_LZ_MAX;
+                while(match < max && from[match] == in[ip + match]) match++;
+                distance = ip - (candidate - 1);
+            }
+        }
+
+        if(match >= KLFS_LZ_MIN) {
+            if(op + 2 > limit) return 0;
+            out[flag_pos] |= 1 << bit;
+            out[op++] = distance >> 4;
+            out[op++] = ((distance & 15) << 4) | (match - KLFS_LZ_MIN);
+            // Positions inside the match can start later matches too
+            for(u32 k = 1; k < match && ip + k + KLFS_LZ_MIN <= length; k++) {
+                klfs_lz_table[klfs_lz_hash(in + ip + k)] = ip + k + 1;
+            }
+            ip += match;
+        } else {
+            if(op >= limit) return 0;
+            out[op++] = in[ip++];
+        }
+        bit++;
+    }
+    return op;
+}
+
+// Decompress exactly length bytes. Fails on input that doesn't decode to
+// that, rather than reading or writing out of bounds.
+static bool klfs_lz_decompress(const u8* in, u32 in_length, u8* out, u32 length) {
+    u32 ip = 0, op = 0;
+    while(op < length) {
+        if(ip >= in_length) return false;
+        u8 flags = in[ip++];
+        for(u32 bit = 0; bit < 8 && op < length; bit++) {
+            if(flags & (1 << bit)) {
+                if(ip + 2 > in_length) return false;
+                u32 distance = (in[ip] << 4) | (in[ip + 1] >> 4);
+                u32 match = (in[ip + 1] & 15) + KLFS_LZ_MIN;
+                ip += 2;
+                if(distance == 0 || distance > op || match > length - op) return false;
+                for(u32 k = 0; k < match; k++, op++) out[op] = out[op - distance];
+            } else {
+                if(ip >= in_length) return false;
+                out[op++] = in[ip++];
+            }
+        }
+    }
+    return true;
+}
+
+// A compressed file is stored in chunks of KLFS_CHUNK_BLOCKS file blocks, one
+// extent per chunk, so extent i always holds chunk i. A chunk is compressed
+// on its own, and stored that way when it saves at least one disk block.
+// Reading a chunk fetches its disk blocks through the block cache and
+// decompresses them into klfs_chunk, where the chunk stays until another one
+// is needed, so sequential reads decompress each chunk once.
+#define KLFS_CHUNK_BLOCKS 16
+#define KLFS_CHUNK_SIZE   (KLFS_CHUNK_BLOCKS * KLFS_BLOCK_SIZE)
+
+static u8 klfs_chunk[KLFS_CHUNK_SIZE];    // Decompressed chunk, zero past its end
+static u8 klfs_packed[KLFS_CHUNK_SIZE];   // Chunk as stored on disk
+static u32 klfs_chunk_start = 0;          // Disk block klfs_chunk came from, 0 = none
+
+static void klfs_chunk_forget(void) {
+    klfs_chunk_start = 0;
+}
+
+// Open files
+// An open file keeps its directory entry and extent map in memory, so reads
+// and writes only touch the data blocks they cover. Metadata goes back to
+// disk after each call that changed it, data blocks first. Opening a file
+// that is already open shares its slot, so every handle sees the same size.
+// Files of up to KLFS_INLINE_MAX bytes keep their contents in the directory
+// entry instead of a data block: reading one costs just the directory block
+// its lookup already fetched, and writing one allocates nothing. A file
+// moves out to data blocks when it grows past that, and back in when it is
+// truncated to fit again.
+#define KLFS_MAX_OPEN 8
+
+typedef struct {
+    u32 opens;                // Handles using this slot, 0 = free
+    klfs_dir_pos_t pos;       // Where the entry lives in the directory
+    klfs_file_entry_t entry;
+    klfs_extent_map_t map;
+    bcache_ra_t ra;           // Read-ahead state for sequential preads
+} klfs_open_t;
+
+static klfs_open_t klfs_open_files[KLFS_MAX_OPEN];
+
+static klfs_open_t* klfs_handle(i32 fd) {
+    if(fd < 0 || fd >= KLFS_MAX_OPEN || klfs_open_files[fd].opens == 0) {
+        kprint("Error: Bad file handle\n");
+        return 0;
+    }
+    return &klfs_open_files[fd];
+}
+
+static bool klfs_is_open(const klfs_dir_pos_t* pos) {
+    for(u32 i = 0; i < KLFS_MAX_OPEN; i++) {
+        klfs_open_t* of = &klfs_open_files[i];
+        if(of->opens && of->pos.block == pos->block && of->pos.index == pos->index) return true;
+    }
+    return false;
+}
+
+// Mount the root disk up front rather than on first use, and read in the
+// directory's root and bucket tables, the group table and the first groups'
+// bitmaps, so the first commands don't wait on the disk either
+bool klfs_mount(void) {
+    klfs_superblock_t sb;
+    u32 pointers[KLFS_PTRS_PER_BLOCK];
+
+    if(klfs_mounted) {
+        kprint("KLFS is already mounted\n");
+        return true;
+    }
+    if(!klfs_load_super(&sb)) return false;
+
+    // Both kinds of table get at most half the metadata cache
+    u32 root[KLFS_PTRS_PER_BLOCK];
+    u32 tables = (sb.dir_buckets + KLFS_PTRS_PER_BLOCK - 1) / KLFS_PTRS_PER_BLOCK;
+    if(!klfs_meta_read(sb.dir_root, root)) {
+        kprint("Error: Failed to read directory\n");
+        return false;
+    }
+    for(u32 t = 0; t < tables && t < KLFS_MCACHE_BLOCKS / 2; t++) {
+        if(root[t] && !klfs_meta_read(root[t], pointers)) {
+            kprint("Error: Failed to read directory\n");
+            return false;
+        }
+    }
+    u32 table_blocks = (sb.group_count + KLFS_GROUPS_PER_TABLE_BLOCK - 1) / KLFS_GROUPS_PER_TABLE_BLOCK;
+    for(u32 i = 0; i < table_blocks && i < KLFS_MCACHE_BLOCKS / 2; i++) {
+        if(!klfs_meta_read(sb.group_table + i, pointers)) {
+            kprint("Error: Failed to read group table\n");
+            return false;
+        }
+    }
+    for(u32 group = 0; group < sb.group_count && group < KLFS_GROUP_SLOTS; group++) {
+        if(!klfs_group_get(&sb, group)) return false;
+    }
+
+    kprint("KLFS mounted: "); kprint_dec(sb.file_count); kprint(" files, ");
+    kprint_dec(sb.free_blocks); kprint(" of "); kprint_dec(sb.total_blocks); kprint(" blocks free\n");
+    return true;
+}
+
+// Write everything back and forget the disk, so it can be switched or
+// powered off. The next command that uses KLFS mounts it again.
+bool klfs_umount(void) {
+    for(u32 i = 0; i < KLFS_MAX_OPEN; i++) {
+        if(klfs_open_files[i].opens) {
+            kprint("Error: Files are open\n");
+            return false;
+        }
+    }
+    if(!klfs_sync()) {
+        kprint("Error: Failed to flush cache\n");
+        return false;
+    }
+    klfs_invalidate();
+    return true;
+}
+
+// Map a file block to its disk block. *run gets how many blocks from there on
+// are contiguous on disk (to the end of the extent). A block in a hole maps
+// to 0, and *run gets how many blocks are left in the hole.
+static bool klfs_map(klfs_open_t* of, u32 logical, u32* block, u32* run) {
+    u32 next = of->entry.block_count;
+    for(u32 i = 0; i < of->map.count; i++) {
+        klfs_extent_t* ext = &of->map.extents[i];
+        if(logical >= ext->logical && logical < ext->logical + ext->count) {
+            *block = ext->start + (logical - ext->logical);
+            *run = ext->count - (logical - ext->logical);
+            return true;
+        }
+        if(ext->logical > logical) {
+            next = ext->logical;
+            break;
+        }
+    }
+    if(logical >= next) {
+        kprint("Error: Block missing from extent map\n");
+        return false;
+    }
+    *block = 0;
+    *run = next - logical;
+    return true;
+}
+
+// Abort a failed update and re-read the entry and extent map as they were
+static void klfs_revert(klfs_open_t* of) {
+    klfs_dir_block_t dir;
+
+    klfs_tx_abort();
+    klfs_chunk_forget();
+    if(klfs_meta_read(of->pos.block, &dir)) of->entry = dir.entries[of->pos.index];
+    of->map.count = 0;
+    if(of->entry.extent_block) klfs_meta_read(of->entry.extent_block, &of->map);
+}
+
+// Allocate disk blocks for file blocks [logical, logical + count), which must
+// be a hole. Each new piece first tries to continue the extent before it in
+// place, then falls back to the largest free run available.
+static bool klfs_fill(klfs_superblock_t* sb, klfs_open_t* of, u32 logical, u32 count) {
+    klfs_extent_map_t* map = &of->map;
+    if(of->entry.extent_block == 0) {
+        if(!klfs_alloc_run(sb, 1, &of->entry.extent_block)) {
+            kprint("Error: Not enough free space\n");
+            return false;
+        }
+        map->count = 0;
+    }
+    if(count > sb->free_blocks) {
+        kprint("Error: Not enough free space\n");
+        return false;
+    }
+
+    // Where the new extents go to keep the map in file order
+    u32 i = 0;
+    while(i < map->count && map->extents[i].logical < logical) i++;
+
+    while(count > 0) {
+        u32 want = count > KLFS_EXTENT_MAX ? KLFS_EXTENT_MAX : count;
+        klfs_extent_t* prev = i ? &map->extents[i - 1] : 0;
+        bool extendable = prev && prev->logical + prev->count == logical &&
+                          prev->count + want <= KLFS_EXTENT_MAX;
+
+        u32 start, got = want;
+        if(extendable && klfs_alloc_at(sb, prev->start + prev->count, want)) {
+            start = prev->start + prev->count;
+        } else {
+            while(!klfs_alloc_run(sb, got, &start)) {
+                got /= 2;
+                if(got == 0) {
+                    kprint("Error: Not enough free space\n");
+                    return false;
+                }
+            }
+        }
+
+        if(extendable && start == prev->start + prev->count) {
+            prev->count += got;
+        } else {
+            if(map->count == KLFS_MAX_EXTENTS) {
+                kprint("Error: File too fragmented\n");
+                return false;
+            }
+            for(u32 j = map->count; j > i; j--) map->extents[j] = map->extents[j - 1];
+            klfs_extent_t* ext = &map->extents[i++];
+            ext->logical = logical;
+            ext->start = start;
+            ext->count = got;
+            ext->stored = 0;
+            map->count++;
+        }
+        logical += got;
+        count -= got;
+    }
+
+    // A hole filled right up to the next extent may now line up with it
+    if(i > 0 && i < map->count) {
+        klfs_extent_t* prev = &map->extents[i - 1];
+        klfs_extent_t* next = &map->extents[i];
+        if(prev->logical + prev->count == next->logical && prev->start + prev->count == next->start &&
+           prev->count + next->count <= KLFS_EXTENT_MAX) {
+            prev->count += next->count;
+            for(u32 j = i; j + 1 < map->count; j++) map->extents[j] = map->extents[j + 1];
+            map->count--;
+        }
+    }
+    return true;
+}
+
+// Release every block past the first blocks_kept. Only a raw extent can be
+// cut short: a compressed chunk's disk blocks don't line up with its file
+// blocks, so a caller cutting into one must rebuild it to the new length
+// first (see klfs_chunk_truncate).
+static bool klfs_shrink(klfs_superblock_t* sb, klfs_open_t* of, u32 blocks_kept) {
+    while(of->map.count > 0) {
+        klfs_extent_t* last = &of->map.extents[of->map.count - 1];
+        if(last->logical >= blocks_kept) {
+            if(!klfs_release_run(sb, last->start, klfs_extent_disk(last))) return false;
+            of->map.count--;
+        } else {
+            u32 keep = blocks_kept - last->logical;
+            if(keep < last->count) {
+                if(last->stored) {
+                    kprint("Error: Can't cut a compressed chunk short\n");
+                    return false;
+                }
+                if(!klfs_release_run(sb, last->start + keep, last->count - keep)) return false;
+                last->count = keep;
+            }
+            break;
+        }
+    }
+    of->entry.block_count = blocks_kept;
+    if(of->map.count == 0 && of->entry.extent_block) {
+        klfs_free_run(sb, of->entry.extent_block, 1);
+        of->entry.extent_block = 0;
+    }
+    return true;
+}
+
+// Point one file block at a different disk block, splitting its extent and
+// merging it with its neighbours where they now line up
+static bool klfs_remap(klfs_open_t* of, u32 logical, u32 block) {
+    klfs_extent_map_t* map = &of->map;
+    u32 i = 0;
+    while(i < map->count && !(logical >= map->extents[i].logical &&
+                              logical < map->extents[i].logical + map->extents[i].count)) i++;
+    if(i == map->count) {
+        kprint("Error: Block missing from extent map\n");
+        return false;
+    }
+    if(map->count + 2 > KLFS_MAX_EXTENTS) {
+        kprint("Error: File too fragmented\n");
+        return false;
+    }
+
+    // Split into [before] [logical] [after], dropping the empty parts
+    klfs_extent_t old = map->extents[i];
+    klfs_extent_t parts[3];
+    u32 nparts = 0;
+    u32 skip = logical - old.logical;
+    if(skip > 0) {
+        parts[nparts].logical = old.logical;
+        parts[nparts].start = old.start;
+        parts[nparts].stored = 0;
+        parts[nparts++].count = skip;
+    }
+    parts[nparts].logical = logical;
+    parts[nparts].start = block;
+    parts[nparts].stored = 0;
+    parts[nparts++].count = 1;
+    if(skip + 1 < old.count) {
+        parts[nparts].logical = logical + 1;
+        parts[nparts].start = old.start + skip + 1;
+        parts[nparts].stored = 0;
+        parts[nparts++].count = old.count - skip - 1;
+    }
+
+    for(u32 j = map->count; j > i + 1; j--) map->extents[j - 1 + nparts - 1] = map->extents[j - 1];
+    for(u32 j = 0; j < nparts; j++) map->extents[i + j] = parts[j];
+    map->count += nparts - 1;
+
+    // Merge neighbours that are contiguous on disk
+    u32 out = 0;
+    for(u32 j = 1; j < map->count; j++) {
+        klfs_extent_t* prev = &map->extents[out];
+        klfs_extent_t* ext = &map->extents[j];
+        if(prev->start + prev->count == ext->start && prev->logical + prev->count == ext->logical &&
+           prev->count + ext->count <= KLFS_EXTENT_MAX) {
+            prev->count += ext->count;
+        } else {
+            map->extents[++out] = *ext;
+        }
+    }
+    map->count = out + 1;
+    return true;
+}
+
+// Give the file private copies of any shared blocks among file blocks
+// [first, last]. Blocks the caller is about to overwrite completely don't
+// need their old contents copied; the partial ones at either end do.
+static bool klfs_unshare(klfs_superblock_t* sb, klfs_open_t* of, u32 offset, u32 end, bool* remapped) {
+    if(!(of->entry.flags & KLFS_FILE_SHARED) || sb->shared_blocks == 0) return true;
+
+    u32 first = offset / KLFS_BLOCK_SIZE;
+    u32 last = (end - 1) / KLFS_BLOCK_SIZE;
+    if(last >= of->entry.block_count) last = of->entry.block_count - 1;
+
+    klfs_refwalk_t walk;
+    klfs_refwalk_init(&walk);
+    u32 prev_new = 0;
+    for(u32 logical = first; logical <= last && logical < of->entry.block_count; logical++) {
+        u32 block, run;
+        if(!klfs_map(of, logical, &block, &run)) return false;
+        if(block == 0) continue;
+        u8* ref = klfs_ref_get(sb, &walk, block);
+        if(!ref) return false;
+        if(*ref == 0) continue;
+
+        // Copies of a run of shared blocks are kept contiguous when possible
+        u32 copy = prev_new + 1;
+        if(prev_new == 0 || !klfs_alloc_at(sb, copy, 1)) {
+            if(!klfs_alloc_run(sb, 1, &copy)) {
+                kprint("Error: Not enough free space\n");
+                return false;
+            }
+        }
+        prev_new = copy;
+
+        bool covered = offset <= logical * KLFS_BLOCK_SIZE && end >= (logical + 1) * KLFS_BLOCK_SIZE;
+        if(!covered) {
+            u8 block_data[KLFS_BLOCK_SIZE];
+            if(!read_block(block, block_data) || !write_block(copy, block_data)) {
+                kprint("Error: Failed to copy shared block\n");
+                return false;
+            }
+        }
+
+        (*ref)--;
+        walk.dirty = true;
+        sb->shared_blocks--;
+        if(!klfs_remap(of, logical, copy)) return false;
+        *remapped = true;
+    }
+    return klfs_ref_put(&walk);
+}
+
+// Write the directory entry, plus the extent map, bitmap and superblock if
+// blocks were allocated or freed. A size change alone only costs the entry.
+static bool klfs_commit(klfs_superblock_t* sb, klfs_open_t* of, bool blocks_changed) {
+    if(!blocks_changed) return klfs_dir_store(&of->pos, &of->entry);
+
+    if(of->entry.extent_block && !klfs_meta_write(of->entry.extent_block, &of->map)) {
+        kprint("Error: Failed to write extent map\n");
+        return false;
+    }
+    return klfs_dir_store(&of->pos, &of->entry) && klfs_store_super(sb);
+}
+
+static bool klfs_is_zero(const u8* data, u32 length) {
+    for(u32 i = 0; i < length; i++) {
+        if(data[i]) return false;
+    }
+    return true;
+}
+
+static bool klfs_is_inline(const klfs_file_entry_t* file) {
+    return file->extent_block == 0 && file->size <= KLFS_INLINE_MAX;
+}
+
+// Move inline contents out to a first data block, before the file outgrows
+// its entry
+static bool klfs_uninline(klfs_superblock_t* sb, klfs_open_t* of) {
+    u8 block_data[KLFS_BLOCK_SIZE];
+    u32 block, run;
+
+    klfs_zero(block_data, sizeof(block_data));
+    for(u32 i = 0; i < of->entry.size; i++) block_data[i] = of->entry.inline_data[i];
+    if(!klfs_fill(sb, of, 0, 1) || !klfs_map(of, 0, &block, &run)) return false;
+    of->entry.block_count = 1;
+    if(!write_block(block, block_data)) {
+        kprint("Error: Failed to write data block\n");
+        return false;
+    }
+    klfs_zero(of->entry.inline_data, KLFS_INLINE_MAX);
+    return true;
+}
+
+// Load chunk index of a compressed file into klfs_chunk. *blocks gets its
+// length in file blocks; a chunk past the end of the file loads as zeros.
+static bool klfs_chunk_load(klfs_open_t* of, u32 index, u32* blocks) {
+    if(index >= of->map.count) {
+        klfs_chunk_forget();
+        klfs_zero(klfs_chunk, KLFS_CHUNK_SIZE);
+        *blocks = 0;
+        return true;
+    }
+
+    klfs_extent_t* ext = &of->map.extents[index];
+    *blocks = ext->count;
+    if(ext->start == klfs_chunk_start) return true;
+
+    klfs_chunk_forget();
+    u32 length = ext->count * KLFS_BLOCK_SIZE;
+    if(ext->stored == 0) {
+        if(!read_blocks(ext->start, ext->count, klfs_chunk)) {
+            kprint("Error: Failed to read data block\n");
+            return false;
+        }
+    } else {
+        if(!read_blocks(ext->start, ext->stored, klfs_packed)) {
+            kprint("Error: Failed to read data block\n");
+            return false;
+        }
+        if(!klfs_lz_decompress(klfs_packed, ext->stored * KLFS_BLOCK_SIZE, klfs_chunk, length)) {
+            kprint("Error: Corrupt compressed data\n");
+            return false;
+        }
+    }
+    klfs_zero(klfs_chunk + length, KLFS_CHUNK_SIZE - length);
+    klfs_chunk_start = ext->start;
+    return true;
+}
+
+// Write the first blocks file blocks of klfs_chunk to newly allocated disk
+// blocks, compressed if asked and if that saves a block, and describe them
+// in *ext (all but logical)
+static bool klfs_chunk_put(klfs_superblock_t* sb, u32 blocks, bool compress, klfs_extent_t* ext) {
+    u32 length = blocks * KLFS_BLOCK_SIZE;
+    u32 packed = compress ? klfs_lz_compress(klfs_chunk, length, klfs_packed, length - KLFS_BLOCK_SIZE) : 0;
+    u32 stored = (packed + KLFS_BLOCK_SIZE - 1) / KLFS_BLOCK_SIZE;
+    if(stored) klfs_zero(klfs_packed + packed, stored * KLFS_BLOCK_SIZE - packed);
+
+    u32 disk = stored ? stored : blocks;
+    if(!klfs_alloc_run(sb, disk, &ext->start)) {
+        kprint("Error: Not enough free space\n");
+        return false;
+    }
+    if(!write_blocks(ext->start, disk, stored ? klfs_packed : klfs_chunk)) {
+        kprint("Error: Failed to write data block\n");
+        return false;
+    }
+    ext->count = blocks;
+    ext->stored = stored;
+    return true;
+}
+
+// Replace chunk index of a compressed file (or add it after the last one)
+// with the first blocks file blocks of klfs_chunk. The old blocks are only
+// released, so they stay intact until the transaction commits, and a chunk
+// shared with a copy of the file needs no special care.
+static bool klfs_chunk_store(klfs_superblock_t* sb, klfs_open_t* of, u32 index, u32 blocks) {
+    if(of->entry.extent_block == 0) {
+        if(!klfs_alloc_run(sb, 1, &of->entry.extent_block)) {
+            kprint("Error: Not enough free space\n");
+            return false;
+        }
+        of->map.count = 0;
+    }
+    if(index == of->map.count && index == KLFS_MAX_EXTENTS) {
+        kprint("Error: File too large to compress\n");
+        return false;
+    }
+
+    klfs_extent_t ext;
+    klfs_chunk_forget();
+    if(!klfs_chunk_put(sb, blocks, true, &ext)) return false;
+    ext.logical = index * KLFS_CHUNK_BLOCKS;
+    if(index < of->map.count) {
+        klfs_extent_t* old = &of->map.extents[index];
+        if(!klfs_release_run(sb, old->start, klfs_extent_disk(old))) return false;
+    } else {
+        of->map.count++;
+    }
+    of->map.extents[index] = ext;
+    klfs_chunk_start = ext.start;
+
+    klfs_extent_t* last = &of->map.extents[of->map.count - 1];
+    of->entry.block_count = last->logical + last->count;
+    return true;
+}
+
+// pread for a compressed file
+static i32 klfs_chunk_read(klfs_open_t* of, u32 offset, u32 length, u8* dest) {
+    u32 pos = offset, end = offset + length;
+    while(pos < end) {
+        u32 within = pos % KLFS_CHUNK_SIZE;
+        u32 chunk = KLFS_CHUNK_SIZE - within;
+        if(chunk > end - pos) chunk = end - pos;
+
+        u32 blocks;
+        if(!klfs_chunk_load(of, pos / KLFS_CHUNK_SIZE, &blocks)) return -1;
+        for(u32 i = 0; i < chunk; i++) dest[i] = klfs_chunk[within + i];
+
+        dest += chunk;
+        pos += chunk;
+    }
+    return (i32)length;
+}
+
+// pwrite for a compressed file: rebuild every chunk the range [offset, end)
+// touches, and fill in any missing ones before it. A null src writes zeros.
+static bool klfs_chunk_write(klfs_superblock_t* sb, klfs_open_t* of, u32 offset, u32 end, const u8* src) {
+    if(klfs_is_inline(&of->entry) && of->entry.size > 0) {
+        klfs_chunk_forget();
+        klfs_zero(klfs_chunk, KLFS_CHUNK_SIZE);
+        for(u32 i = 0; i < of->entry.size; i++) klfs_chunk[i] = of->entry.inline_data[i];
+        if(!klfs_chunk_store(sb, of, 0, 1)) return false;
+        klfs_zero(of->entry.inline_data, KLFS_INLINE_MAX);
+    }
+
+    // Writing past the end also pads out a partial last chunk
+    u32 first = offset / KLFS_CHUNK_SIZE;
+    u32 last = (end - 1) / KLFS_CHUNK_SIZE;
+    if(first > of->map.count) first = of->map.count;
+    if(first == of->map.count && first > 0) first--;
+    for(u32 index = first; index <= last; index++) {
+        u32 base = index * KLFS_CHUNK_SIZE;
+        u32 blocks;
+        if(!klfs_chunk_load(of, index, &blocks)) return false;
+
+        // Chunks before the last one are full
+        u32 needed = KLFS_CHUNK_BLOCKS;
+        if(offset < base + KLFS_CHUNK_SIZE) {
+            u32 from = offset > base ? offset - base : 0;
+            u32 to = end - base < KLFS_CHUNK_SIZE ? end - base : KLFS_CHUNK_SIZE;
+            klfs_chunk_forget();
+            if(src) {
+                for(u32 i = from; i < to; i++) klfs_chunk[i] = src[base + i - offset];
+            }
+            if(index == last) needed = (to + KLFS_BLOCK_SIZE - 1) / KLFS_BLOCK_SIZE;
+        } else if(blocks == KLFS_CHUNK_BLOCKS) {
+            continue;
+        }
+        if(needed < blocks) needed = blocks;
+        if(!klfs_chunk_store(sb, of, index, needed)) return false;
+    }
+
+    if(end > of->entry.size) of->entry.size = end;
+    return true;
+}
+
+// truncate for a compressed file
+static bool klfs_chunk_truncate(klfs_superblock_t* sb, klfs_open_t* of, u32 size) {
+    if(size > of->entry.size) return klfs_chunk_write(sb, of, of->entry.size, size, 0);
+    if(size == of->entry.size) return true;
+
+    u32 blocks;
+    if(size <= KLFS_INLINE_MAX) {
+        // Small enough to move back into the directory entry
+        if(size > 0 && !klfs_chunk_load(of, 0, &blocks)) return false;
+        klfs_zero(of->entry.inline_data, KLFS_INLINE_MAX);
+        for(u32 i = 0; i < size; i++) of->entry.inline_data[i] = klfs_chunk[i];
+        if(!klfs_shrink(sb, of, 0)) return false;
+        of->entry.size = size;
+        return true;
+    }
+
+    // Rebuild the new last chunk without the cut-off data, then drop the
+    // chunks past it
+    u32 index = (size - 1) / KLFS_CHUNK_SIZE;
+    u32 within = size - index * KLFS_CHUNK_SIZE;
+    if(!klfs_chunk_load(of, index, &blocks)) return false;
+    klfs_chunk_forget();
+    klfs_zero(klfs_chunk + within, KLFS_CHUNK_SIZE - within);
+    blocks = (within + KLFS_BLOCK_SIZE - 1) / KLFS_BLOCK_SIZE;
+    if(!klfs_chunk_store(sb, of, index, blocks) ||
+       !klfs_shrink(sb, of, index * KLFS_CHUNK_BLOCKS + blocks)) return false;
+    of->entry.size = size;
+    return true;
+}
+
+// Rewrite a file's data compressed or uncompressed into a new extent map,
+// then release the old blocks. Sets *changed if any block was allocated or
+// released, so the caller knows to write back the map and the superblock.
+static bool klfs_convert(klfs_superblock_t* sb, i32 fd, bool compress, bool* changed) {
+    klfs_open_t* of = &klfs_open_files[fd];
+    klfs_extent_map_t map;
+
+    map.count = 0;
+    *changed = false;
+    for(u32 logical = 0; logical < of->entry.block_count; logical += KLFS_CHUNK_BLOCKS) {
+        u32 blocks = of->entry.block_count - logical;
+        if(blocks > KLFS_CHUNK_BLOCKS) blocks = KLFS_CHUNK_BLOCKS;
+        u32 offset = logical * KLFS_BLOCK_SIZE;
+        u32 length = of->entry.size - offset;
+        if(length > KLFS_CHUNK_SIZE) length = KLFS_CHUNK_SIZE;
+
+        // Reading a compressed chunk into klfs_chunk copies it onto itself
+        klfs_chunk_forget();
+        if(!(of->entry.flags & KLFS_FILE_COMPRESSED)) klfs_zero(klfs_chunk, KLFS_CHUNK_SIZE);
+        if(klfs_pread(fd, offset, length, klfs_chunk) != (i32)length) return false;
+        klfs_chunk_forget();
+
+        // Compressed files keep one extent per chunk, but an uncompressed
+        // one can leave its zero chunks as holes
+        if(!compress && map.count < KLFS_SPARSE_EXTENTS && klfs_is_zero(klfs_chunk, blocks * KLFS_BLOCK_SIZE)) {
+            of->entry.flags |= KLFS_FILE_SPARSE;
+            continue;
+        }
+
+        klfs_extent_t ext;
+        if(!klfs_chunk_put(sb, blocks, compress, &ext)) return false;
+        *changed = true;
+        ext.logical = logical;
+        klfs_extent_t* prev = map.count ? &map.extents[map.count - 1] : 0;
+        if(!compress && prev && prev->start + prev->count == ext.start &&
+           prev->logical + prev->count == ext.logical && prev->count + ext.count <= KLFS_EXTENT_MAX) {
+            prev->count += ext.count;
+        } else if(map.count == KLFS_MAX_EXTENTS) {
+            kprint(compress ? "Error: File too large to compress\n" : "Error: File too fragmented\n");
+            return false;
+        } else {
+            map.extents[map.count++] = ext;
+        }
+    }
+
+    for(u32 i = 0; i < of->map.count; i++) {
+        if(!klfs_release_run(sb, of->map.extents[i].start, klfs_extent_disk(&of->map.extents[i]))) return false;
+        *changed = true;
+    }
+    of->map = map;
+
+    // A sparse file can be all holes, with no extent block, and still turn
+    // into chunks that need a map; or go the other way
+    if(map.count > 0 && of->entry.extent_block == 0) {
+        if(!klfs_alloc_run(sb, 1, &of->entry.extent_block)) {
+            kprint("Error: Not enough free space\n");
+            return false;
+        }
+    } else if(map.count == 0 && of->entry.extent_block) {
+        klfs_free_run(sb, of->entry.extent_block, 1);
+        of->entry.extent_block = 0;
+    }
+    return true;
+}
+
+// Open a file by name, optionally creating it. Returns a handle, or -1.
+i32 klfs_open(const char* filename, bool create) {
+    klfs_superblock_t sb;
+    klfs_file_entry_t file;
+    klfs_dir_pos_t pos;
+
+    if(!klfs_load_super(&sb)) return -1;
+
+    if(!klfs_lookup(&sb, filename, &file, &pos)) {
+        if(!create) {
+            kprint("Error: File not found\n");
+            return -1;
+        }
+        if(!klfs_create(&sb, filename) || !klfs_lookup(&sb, filename, &file, &pos)) return -1;
+    }
+
+    // Already open: share the slot
+    for(i32 fd = 0; fd < KLFS_MAX_OPEN; fd++) {
+        klfs_open_t* of = &klfs_open_files[fd];
+        if(of->opens && of->pos.block == pos.block && of->pos.index == pos.index) {
+            of->opens++;
+            return fd;
+        }
+    }
+
+    for(i32 fd = 0; fd < KLFS_MAX_OPEN; fd++) {
+        klfs_open_t* of = &klfs_open_files[fd];
+        if(of->opens) continue;
+
+        of->pos = pos;
+        of->entry = file;
+        of->map.count = 0;
+        if(file.extent_block && !klfs_meta_read(file.extent_block, &of->map)) {
+            kprint("Error: Failed to read extent map\n");
+            return -1;
+        }
+        bcache_ra_init(&of->ra, of->map.count ? of->map.extents[0].start : 0);
+        of->opens = 1;
+        return fd;
+    }
+
+    kprint("Error: Too many open files\n");
+    return -1;
+}
+
+bool klfs_close(i32 fd) {
+    klfs_open_t* of = klfs_handle(fd);
+    if(!of) return false;
+    of->opens--;
+    return true;
+}
+
+u32 klfs_size(i32 fd) {
+    klfs_open_t* of = klfs_handle(fd);
+    return of ? of->entry.size : 0;
+}
+
+// Read up to length bytes at offset. Returns the bytes read (short at end of
+// file), or -1 on error.
+i32 klfs_pread(i32 fd, u32 offset, u32 length, void* buffer) {
+    klfs_open_t* of = klfs_handle(fd);
+    if(!of) return -1;
+
+    if(offset >= of->entry.size) return 0;
+    if(length > of->entry.size - offset) length = of->entry.size - offset;
+
+    u8* dest = (u8*)buffer;
+    if(klfs_is_inline(&of->entry)) {
+        for(u32 i = 0; i < length; i++) dest[i] = of->entry.inline_data[offset + i];
+        return (i32)length;
+    }
+    if(of->entry.flags & KLFS_FILE_COMPRESSED) return klfs_chunk_read(of, offset, length, dest);
+
+    u32 pos = offset, end = offset + length;
+    while(pos < end) {
+        u32 logical = pos / KLFS_BLOCK_SIZE;
+        u32 within = pos % KLFS_BLOCK_SIZE;
+        u32 chunk = KLFS_BLOCK_SIZE - within;
+        if(chunk > end - pos) chunk = end - pos;
+
+        u32 block, run;
+        if(!klfs_map(of, logical, &block, &run)) return -1;
+
+        // A hole reads as zeros without touching the disk
+        if(block == 0) {
+            u32 hole = run * KLFS_BLOCK_SIZE - within;
+            if(hole > end - pos) hole = end - pos;
+            klfs_zero(dest, hole);
+            dest += hole;
+            pos += hole;
+            continue;
+        }
+
+        // Whole blocks land straight in the caller's buffer
+        u8 block_data[KLFS_BLOCK_SIZE];
+        u8* target = (chunk == KLFS_BLOCK_SIZE) ? dest : block_data;
+        if(!bcache_read_ahead(&of->ra, block, block + run, target)) {
+            kprint("Error: Failed to read data block\n");
+            return -1;
+        }
+        if(!klfs_csum_check(block, 1, target)) return -1;
+        if(target != dest) {
+            for(u32 i = 0; i < chunk; i++) dest[i] = block_data[within + i];
+        }
+
+        dest += chunk;
+        pos += chunk;
+    }
+    return (i32)length;
+}
+
+// Write length bytes at offset, growing the file as needed. Only the blocks
+// the range covers are written: whole blocks straight from the buffer (as
+// one transfer per contiguous run), partial ones read-modify-write.
+i32 klfs_pwrite(i32 fd, u32 offset, u32 length, const void* buffer) {
+    klfs_superblock_t sb;
+    klfs_open_t* of = klfs_handle(fd);
+    if(!of) return -1;
+    if(length == 0) return 0;
+
+    u32 end = offset + length;
+    if(end < offset) {
+        kprint("Error: File too large\n");
+        return -1;
+    }
+    if(!klfs_load_super(&sb) || !klfs_tx_begin()) return -1;
+
+    // Set when the extent map or the free space changes
+    bool remapped = false;
+
+    if(klfs_is_inline(&of->entry) && end <= KLFS_INLINE_MAX) {
+        // Still fits: only the directory entry changes
+        const u8* src = (const u8*)buffer;
+        for(u32 i = 0; i < length; i++) of->entry.inline_data[offset + i] = src[i];
+        if(end > of->entry.size) of->entry.size = end;
+        if(!klfs_dir_store(&of->pos, &of->entry)) {
+            klfs_revert(of);
+            return -1;
+        }
+        klfs_tx_end();
+        return (i32)length;
+    }
+    if(of->entry.flags & KLFS_FILE_COMPRESSED) {
+        if(!klfs_chunk_write(&sb, of, offset, end, (const u8*)buffer) || !klfs_commit(&sb, of, true)) {
+            klfs_revert(of);
+            return -1;
+        }
+        klfs_tx_end();
+        return (i32)length;
+    }
+    if(klfs_is_inline(&of->entry) && of->entry.size > 0) {
+        if(!klfs_uninline(&sb, of)) {
+            klfs_revert(of);
+            return -1;
+        }
+        remapped = true;
+    }
+
+    // Blocks past the old end start out as holes, so any the write skips
+    // over cost nothing and read back as zeros
+    u32 blocks_needed = (end + KLFS_BLOCK_SIZE - 1) / KLFS_BLOCK_SIZE;
+    if(blocks_needed > of->entry.block_count) {
+        if(offset / KLFS_BLOCK_SIZE > of->entry.block_count) of->entry.flags |= KLFS_FILE_SPARSE;
+        of->entry.block_count = blocks_needed;
+    }
+
+    // Blocks shared with a copy of the file get replaced before being written
+    if(!klfs_unshare(&sb, of, offset, end, &remapped)) {
+        klfs_revert(of);
+        return -1;
+    }
+
+    const u8* src = (const u8*)buffer;
+    u32 pos = offset;
+    while(pos < end) {
+        u32 logical = pos / KLFS_BLOCK_SIZE;
+        u32 within = pos % KLFS_BLOCK_SIZE;
+        u32 chunk = KLFS_BLOCK_SIZE - within;
+        if(chunk > end - pos) chunk = end - pos;
+        u32 block, run;
+        if(!klfs_map(of, logical, &block, &run)) {
+            klfs_revert(of);
+            return -1;
+        }
+
+        // Zeros written into a hole leave it a hole
+        bool sparse = of->map.count < KLFS_SPARSE_EXTENTS;
+        if(block == 0 && sparse && klfs_is_zero(src, chunk)) {
+            of->entry.flags |= KLFS_FILE_SPARSE;
+            src += chunk;
+            pos += chunk;
+            continue;
+        }
+
+        if(within == 0 && end - pos >= KLFS_BLOCK_SIZE) {
+            u32 count = (end - pos) / KLFS_BLOCK_SIZE;
+            if(count > run) count = run;
+            if(block == 0) {
+                // Allocate the hole up to its end, the end of the write or the
+                // next zero block, then go round again to write it
+                u32 fill = 1;
+                while(fill < count &&
+                      !(sparse && klfs_is_zero(src + fill * KLFS_BLOCK_SIZE, KLFS_BLOCK_SIZE))) fill++;
+                if(!klfs_fill(&sb, of, logical, fill)) {
+                    klfs_revert(of);
+                    return -1;
+                }
+                remapped = true;
+                continue;
+            }
+            if(!write_blocks(block, count, src)) {
+                kprint("Error: Failed to write data block\n");
+                klfs_revert(of);
+                return -1;
+            }
+            src += count * KLFS_BLOCK_SIZE;
+            pos += count * KLFS_BLOCK_SIZE;
+            continue;
+        }
+
+        u8 block_data[KLFS_BLOCK_SIZE];
+        if(block == 0) {
+            klfs_zero(block_data, sizeof(block_data));
+            if(!klfs_fill(&sb, of, logical, 1) || !klfs_map(of, logical, &block, &run)) {
+                klfs_revert(of);
+                return -1;
+            }
+            remapped = true;
+        } else if(!read_block(block, block_data)) {
+            kprint("Error: Failed to read data block\n");
+            klfs_revert(of);
+            return -1;
+        }
+        for(u32 i = 0; i < chunk; i++) block_data[within + i] = src[i];
+        if(!write_block(block, block_data)) {
+            kprint("Error: Failed to write data block\n");
+            klfs_revert(of);
+            return -1;
+        }
+        src += chunk;
+        pos += chunk;
+    }
+
+    if(remapped || end > of->entry.size) {
+        if(end > of->entry.size) of->entry.size = end;
+        if(!klfs_commit(&sb, of, remapped)) {
+            klfs_revert(of);
+            return -1;
+        }
+    }
+    klfs_tx_end();
+    return (i32)length;
+}
+
+// Set the file size, freeing blocks past the new end or adding a hole
+bool klfs_truncate(i32 fd, u32 size) {
+    klfs_superblock_t sb;
+    klfs_open_t* of = klfs_handle(fd);
+    if(!of) return false;
+    if(!klfs_load_super(&sb) || !klfs_tx_begin()) return false;
+
+    bool remapped = false;
+    if(klfs_is_inline(&of->entry) && size <= KLFS_INLINE_MAX) {
+        for(u32 i = size; i < KLFS_INLINE_MAX; i++) of->entry.inline_data[i] = 0;
+        of->entry.size = size;
+        if(!klfs_dir_store(&of->pos, &of->entry)) {
+            klfs_revert(of);
+            return false;
+        }
+        klfs_tx_end();
+        return true;
+    }
+    if(of->entry.flags & KLFS_FILE_COMPRESSED) {
+        if(!klfs_chunk_truncate(&sb, of, size) || !klfs_commit(&sb, of, true)) {
+            klfs_revert(of);
+            return false;
+        }
+        klfs_tx_end();
+        return true;
+    }
+    if(klfs_is_inline(&of->entry)) {
+        if(of->entry.size > 0) {
+            if(!klfs_uninline(&sb, of)) {
+                klfs_revert(of);
+                return false;
+            }
+            remapped = true;
+        }
+    } else if(size <= KLFS_INLINE_MAX) {
+        // Small enough to move back into the directory entry
+        u8 block_data[KLFS_BLOCK_SIZE];
+        u32 block = 0, run;
+        klfs_zero(block_data, sizeof(block_data));
+        if(size > 0 && (!klfs_map(of, 0, &block, &run) || (block && !read_block(block, block_data)))) {
+            klfs_revert(of);
+            return false;
+        }
+        if(!klfs_shrink(&sb, of, 0)) {
+            klfs_revert(of);
+            return false;
+        }
+        klfs_zero(of->entry.inline_data, KLFS_INLINE_MAX);
+        for(u32 i = 0; i < size; i++) of->entry.inline_data[i] = block_data[i];
+        of->entry.size = size;
+        if(!klfs_commit(&sb, of, true)) {
+            klfs_revert(of);
+            return false;
+        }
+        klfs_tx_end();
+        return true;
+    }
+
+    u32 old_blocks = of->entry.block_count;
+    u32 blocks_needed = (size + KLFS_BLOCK_SIZE - 1) / KLFS_BLOCK_SIZE;
+
+    if(blocks_needed < old_blocks) {
+        if(!klfs_shrink(&sb, of, blocks_needed)) {
+            klfs_revert(of);
+            return false;
+        }
+    } else if(blocks_needed > old_blocks) {
+        // The old last block is already zero past the old size
+        of->entry.block_count = blocks_needed;
+        of->entry.flags |= KLFS_FILE_SPARSE;
+    }
+
+    // Clear what's left of the old data in a kept partial last block, so it
+    // reads back as zeros if the file grows again
+    u32 within = size % KLFS_BLOCK_SIZE;
+    if(size < of->entry.size && within && blocks_needed <= old_blocks) {
+        u8 block_data[KLFS_BLOCK_SIZE];
+        u32 block, run;
+        if(!klfs_unshare(&sb, of, size, size + 1, &remapped) ||
+           !klfs_map(of, blocks_needed - 1, &block, &run) || (block && !read_block(block, block_data))) {
+            klfs_revert(of);
+            return false;
+        }
+        for(u32 i = within; i < KLFS_BLOCK_SIZE; i++) block_data[i] = 0;
+        if(block && !write_block(block, block_data)) {
+            kprint("Error: Failed to write data block\n");
+            klfs_revert(of);
+            return false;
+        }
+    }
+
+    of->entry.size = size;
+    if(!klfs_commit(&sb, of, blocks_needed < old_blocks || remapped)) {
+        klfs_revert(of);
+        return false;
+    }
+    klfs_tx_end();
+    return true;
+}
+
+bool klfs_write_file(const char* filename, const char* data) {
+    // Calculate data size
+    u32 data_len = 0;
+    while(data[data_len]) data_len++;  // strlen - this is the original size
+    
+    // Overwrite in place, then cut off whatever the old contents had past the end
+    i32 fd = klfs_open(filename, false);
+    if(fd < 0) return false;
+    bool ok = klfs_pwrite(fd, 0, data_len, data) == (i32)data_len && klfs_truncate(fd, data_len);
+    klfs_close(fd);
+    
+    if(ok) kprint("File written successfully\n");
+    return ok;
+}
+
+bool klfs_append_file(const char* filename, const char* data) {
+    u32 data_len = 0;
+    while(data[data_len]) data_len++;
+    
+    i32 fd = klfs_open(filename, false);
+    if(fd < 0) return false;
+    bool ok = klfs_pwrite(fd, klfs_size(fd), data_len, data) == (i32)data_len;
+    klfs_close(fd);
+    
+    if(ok) kprint("File appended successfully\n");
+    return ok;
+}
+
+// Rewrite an open file's data compressed or raw
+static bool klfs_set_compressed(i32 fd, bool compress) {
+    klfs_superblock_t sb;
+    klfs_open_t* of = &klfs_open_files[fd];
+
+    if(((of->entry.flags & KLFS_FILE_COMPRESSED) != 0) == compress) return true;
+    if(!klfs_load_super(&sb) || !klfs_tx_begin()) return false;
+
+    bool changed;
+    bool ok = klfs_convert(&sb, fd, compress, &changed);
+    of->entry.flags ^= KLFS_FILE_COMPRESSED;
+    ok = ok && klfs_commit(&sb, of, changed);
+    if(!ok) {
+        klfs_revert(of);
+        return false;
+    }
+    klfs_tx_end();
+    return true;
+}
+
+// Turn compression on or off for a file, rewriting its data in the new form
+bool klfs_compress_file(const char* filename, bool compress) {
+    i32 fd = klfs_open(filename, false);
+    if(fd < 0) return false;
+    klfs_open_t* of = &klfs_open_files[fd];
+
+    bool ok = klfs_set_compressed(fd, compress);
+
+    u32 stored = 0;
+    for(u32 i = 0; i < of->map.count; i++) stored += klfs_extent_disk(&of->map.extents[i]);
+    if(ok) {
+        kprint(filename); kprint(": ");
+        kprint_dec(of->entry.block_count); kprint(" blocks stored in ");
+        kprint_dec(stored); kprint("\n");
+    }
+    klfs_close(fd);
+    return ok;
+}
+
+bool klfs_read_file(const char* filename) {
+    i32 fd = klfs_open(filename, false);
+    if(fd < 0) return false;
+    
+    if(klfs_size(fd) == 0) {
+        kprint("(empty file)\n");
+        klfs_close(fd);
+        return true;
+    }
+    
+    // Read and print a block at a time. The handle's read-ahead state keeps
+    // the prefetch window growing while the reads stay sequential.
+    u32 offset = 0;
+    while(true) {
+        u8 block_data[1024];
+        i32 got = klfs_pread(fd, offset, sizeof(block_data), block_data);
+        if(got < 0) {
+            klfs_close(fd);
+            return false;
+        }
+        if(got == 0) break;
+        
+        kprint_bytes((const char*)block_data, got);
+        offset += got;
+    }
+    
+    klfs_close(fd);
+    kprint("\n");  // Add newline at end
+    return true;
+}
+
+bool klfs_delete_file(const char* filename) {
+    klfs_superblock_t sb;
+    klfs_file_entry_t file;
+    klfs_dir_pos_t pos;
+    klfs_extent_map_t map;
+    
+    if(!klfs_load_super(&sb)) return false;
+    
+    // Find the file
+    if(!klfs_lookup(&sb, filename, &file, &pos)) {
+        kprint("Error: File not found\n");
+        return false;
+    }
+    if(klfs_is_open(&pos)) {
+        kprint("Error: File is open\n");
+        return false;
+    }
+    if(file.extent_block && !klfs_meta_read(file.extent_block, &map)) {
+        kprint("Error: Failed to read extent map\n");
+        return false;
+    }
+    
+    // Give the blocks back from the end of the file. A file spread over
+    // many groups would touch more bitmaps than one transaction holds, so
+    // after every few groups the shortened file is committed on its own.
+    if(!klfs_tx_begin()) return false;
+    while(file.extent_block && map.count > 0) {
+        klfs_extent_t* last = &map.extents[map.count - 1];
+        if(!klfs_release_run(&sb, last->start, klfs_extent_disk(last))) {
+            klfs_tx_abort();
+            return false;
+        }
+        map.count--;
+        if(map.count == 0 || klfs_groups_dirty() < KLFS_TX_GROUPS) continue;
+
+        last = &map.extents[map.count - 1];
+        file.block_count = last->logical + last->count;
+        if(file.size > file.block_count * KLFS_BLOCK_SIZE) file.size = file.block_count * KLFS_BLOCK_SIZE;
+        if(!klfs_meta_write(file.extent_block, &map) || !klfs_dir_store(&pos, &file) ||
+           !klfs_store_super(&sb)) {
+            klfs_tx_abort();
+            return false;
+        }
+        klfs_tx_end();
+        if(!klfs_tx_begin()) return false;
+    }
+
+    // Clear the directory entry, as one transaction with the last blocks
+    if(!klfs_dir_store(&pos, 0)) {
+        klfs_tx_abort();
+        return false;
+    }
+    if(file.extent_block) klfs_free_run(&sb, file.extent_block, 1);
+    
+    // Update file count
+    sb.file_count--;
+    
+    // Write updated bitmap and superblock
+    if(!klfs_store_super(&sb)) {
+        klfs_tx_abort();
+        return false;
+    }
+    klfs_tx_end();
+    
+    kprint("File deleted: "); kprint(filename); kprint("\n");
+    return true;
+}
+
+// Copying the data, for when sharing blocks isn't possible: a file with more
+// reference count blocks than one transaction can change, or blocks already
+// at KLFS_MAX_REFS. It goes through one fixed buffer a chunk at a time, so
+// the memory used doesn't depend on the file's size.
+#define KLFS_COPY_BUFFER     (KLFS_SCRATCH_BLOCKS * KLFS_BLOCK_SIZE)
+#define KLFS_COPY_REF_BLOCKS (KLFS_TX_MAX - 8)  // Leaves room for bitmap, map, directory and super
+
+// Most reference count blocks sharing this map could touch. Neighbouring
+// extents (a compressed file's chunks, say) usually share one.
+static u32 klfs_share_span(const klfs_extent_map_t* map) {
+    u32 span = 0, previous = 0xFFFFFFFF;
+    for(u32 i = 0; i < map->count; i++) {
+        u32 first = map->extents[i].start / KLFS_REFS_PER_BLOCK;
+        u32 last = (map->extents[i].start + klfs_extent_disk(&map->extents[i]) - 1) / KLFS_REFS_PER_BLOCK;
+        span += last - first + (first == previous ? 0 : 1);
+        previous = last;
+    }
+    return span;
+}
+
+static bool klfs_copy_data(const char* source, const char* dest, bool compressed) {
+    i32 in = klfs_open(source, false);
+    if(in < 0) return false;
+    i32 out = klfs_open(dest, true);
+    if(out < 0) {
+        klfs_close(in);
+        return false;
+    }
+
+    bool ok = !compressed || klfs_set_compressed(out, true);
+    u32 size = klfs_size(in);
+    for(u32 offset = 0; ok && offset < size; offset += KLFS_COPY_BUFFER) {
+        u32 length = size - offset < KLFS_COPY_BUFFER ? size - offset : KLFS_COPY_BUFFER;
+        ok = klfs_pread(in, offset, length, klfs_scratch) == (i32)length &&
+             klfs_pwrite(out, offset, length, klfs_scratch) == (i32)length;
+    }
+    klfs_close(out);
+    klfs_close(in);
+
+    // Don't leave half a copy behind
+    if(!ok) {
+        klfs_delete_file(dest);
+        return false;
+    }
+    kprint("File copied successfully\n");
+    return true;
+}
+
+bool klfs_copy_file(const char* source, const char* dest) {
+    klfs_superblock_t sb;
+    klfs_file_entry_t file, copy;
+    klfs_dir_pos_t pos;
+    klfs_extent_map_t map;
+    
+    if(!klfs_load_super(&sb)) return false;
+    
+    // Find source file
+    if(!klfs_lookup(&sb, source, &file, &pos)) {
+        kprint("Error: Source file not found\n");
+        return false;
+    }
+    if(klfs_lookup(&sb, dest, &copy, 0)) {
+        kprint("Error: File already exists\n");
+        return false;
+    }
+    if(file.extent_block && !klfs_meta_read(file.extent_block, &map)) {
+        kprint("Error: Failed to read extent map\n");
+        return false;
+    }
+    
+    if(file.extent_block && klfs_share_span(&map) > KLFS_COPY_REF_BLOCKS) {
+        return klfs_copy_data(source, dest, (file.flags & KLFS_FILE_COMPRESSED) != 0);
+    }
+
+    // The copy is a new entry with its own extent map over the same blocks.
+    // No data is read or written; whichever file is written first gets
+    // private copies of the blocks it changes.
+    copy = file;
+    klfs_set_name(&copy, dest);
+    copy.extent_block = 0;
+    
+    if(!klfs_tx_begin()) return false;
+    bool ok = true;
+    if(file.extent_block) {
+        klfs_refwalk_t walk;
+        klfs_refwalk_init(&walk);
+        for(u32 i = 0; ok && i < map.count; i++) {
+            ok = klfs_share_run(&sb, &walk, map.extents[i].start, klfs_extent_disk(&map.extents[i]));
+        }
+        if(!ok) {
+            klfs_tx_abort();
+            return klfs_copy_data(source, dest, (file.flags & KLFS_FILE_COMPRESSED) != 0);
+        }
+        ok = klfs_ref_put(&walk);
+        if(ok && !klfs_alloc_run(&sb, 1, &copy.extent_block)) {
+            kprint("Error: Not enough free space\n");
+            ok = false;
+        }
+        ok = ok && klfs_meta_write(copy.extent_block, &map);
+
+        // Both sides now have to check before writing
+        copy.flags |= KLFS_FILE_SHARED;
+        if(ok && !(file.flags & KLFS_FILE_SHARED)) {
+            file.flags |= KLFS_FILE_SHARED;
+            ok = klfs_dir_store(&pos, &file);
+        }
+    }
+    sb.file_count++;
+    ok = ok && klfs_dir_insert(&sb, &copy) && klfs_store_super(&sb);
+    if(!ok) {
+        klfs_tx_abort();
+        return false;
+    }
+    klfs_tx_end();
+    
+    // An open handle on the source has its own copy of the entry
+    for(u32 i = 0; i < KLFS_MAX_OPEN; i++) {
+        klfs_open_t* of = &klfs_open_files[i];
+        if(of->opens && of->pos.block == pos.block && of->pos.index == pos.index) {
+            of->entry.flags = file.flags;
+        }
+    }
+    
+    kprint("File copied successfully\n");
+    return true;
+}
+
+// Name search
+// A plain name is looked up through the directory's hash index. Patterns
+// with * (any run of characters) or ? (any one character) have to look at
+// every entry, since hashing keeps no order to narrow a prefix down with. A
+// plain name that isn't a file is searched for anywhere in names, as find
+// always has.
+static bool klfs_is_glob(const char* pattern) {
+    for(u32 i = 0; pattern[i]; i++) {
+        if(pattern[i] == '*' || pattern[i] == '?') return true;
+    }
+    return false;
+}
+
+// Match a name against a glob. With partial set, the pattern only has to
+// match the start of the name.
+static bool klfs_glob(const char* pattern, const char* name, bool partial) {
+    const char* star = 0;   // Last * seen, to backtrack to
+    const char* resume = 0; // Where in the name that * should next try from
+
+    while(*name) {
+        if(*pattern == '*') {
+            star = pattern++;
+            resume = name;
+        } else if(*pattern == '?' || (*pattern && *pattern == *name)) {
+            pattern++;
+            name++;
+        } else if(!*pattern && partial) {
+            return true;
+        } else if(star) {
+            pattern = star + 1;
+            name = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while(*pattern == '*') pattern++;
+    return *pattern == 0;
+}
+
+typedef struct {
+    const char* pattern;
+    bool anywhere;  // Pattern may match anywhere in the name
+    u32 found;
+} klfs_find_t;
+
+static bool klfs_find_match(const klfs_find_t* find, const char* name) {
+    if(!find->anywhere) return klfs_glob(find->pattern, name, false);
+    for(u32 j = 0; name[j]; j++) {
+        if(klfs_glob(find->pattern, name + j, true)) return true;
+    }
+    return false;
+}
+
+static void klfs_find_print(const klfs_file_entry_t* file) {
+    kprint(file->name); kprint("  "); kprint_dec(file->size); kprint(" bytes\n");
+}
+
+static void klfs_find_visit(const klfs_file_entry_t* file, void* context) {
+    klfs_find_t* find = (klfs_find_t*)context;
+    if(klfs_find_match(find, file->name)) {
+        klfs_find_print(file);
+        find->found++;
+    }
+}
+
+void klfs_find_file(const char* pattern) {
+    klfs_superblock_t sb;
+    klfs_find_t find = {pattern, false, 0};
+
+    if(!klfs_load_super(&sb)) return;
+
+    if(!klfs_is_glob(pattern)) {
+        klfs_file_entry_t file;
+        if(klfs_lookup(&sb, pattern, &file, 0)) {
+            klfs_find_print(&file);
+            return;
+        }
+        find.anywhere = true;
+    }
+    if(!klfs_dir_walk(&sb, klfs_find_visit, &find)) return;
+
+    if(!find.found) {
+        kprint("No files found matching: "); kprint(pattern); kprint("\n");
+    } else {
+        kprint_dec(find.found); kprint(find.found == 1 ? " file\n" : " files\n");
+    }
+}
+
+// Content search
+// Files are read through klfs_scratch and searched with Boyer-Moore-Horspool:
+// on a mismatch the window moves on by how far the byte under its last
+// position is from the end of the pattern, so a long pattern looks at only a
+// few bytes in each pattern length of text. The last pattern length - 1
+// bytes of each buffer are kept for the next one, so matches across two reads
+// are found too.
+#define KLFS_GREP_MAX     64  // Longest pattern
+#define KLFS_GREP_SHOW    20  // Matches printed; the rest are only counted
+#define KLFS_GREP_CONTEXT 48  // Bytes shown from the start of each match
+
+typedef struct {
+    const u8* pattern;
+    u32 length;
+    u32 skip[256];
+    u32 matches;
+    u32 files;
+    u32 kb;        // Searched so far, in KB
+    u32 bytes;     // And the bytes short of another KB
+    const char* files_pattern;
+    bool failed;
+} klfs_grep_t;
+
+static void klfs_grep_report(klfs_grep_t* grep, const char* name, u32 offset, const u8* at, u32 available) {
+    grep->matches++;
+    if(grep->matches > KLFS_GREP_SHOW) return;
+
+    // The rest of the line, with anything unprintable shown as '.'
+    char line[KLFS_GREP_CONTEXT];
+    u32 n = 0;
+    while(n < KLFS_GREP_CONTEXT && n < available && at[n] != '\n') {
+        line[n] = (at[n] >= 32 && at[n] < 127) ? (char)at[n] : '.';
+        n++;
+    }
+    kprint(name); kprint(" @ "); kprint_dec(offset); kprint(": ");
+    kprint_bytes(line, n);
+    kprint("\n");
+}
+
+static void klfs_grep_file(klfs_grep_t* grep, const char* name) {
+    i32 fd = klfs_open(name, false);
+    if(fd < 0) {
+        grep->failed = true;
+        return;
+    }
+
+    const u8* pattern = grep->pattern;
+    u32 m = grep->length;
+    u32 size = klfs_size(fd);
+    u32 keep = 0;  // Bytes carried over at the start of the buffer
+    u32 base = 0;  // File offset of klfs_scratch[0]
+
+    for(u32 offset = 0; offset < size; ) {
+        u32 length = sizeof(klfs_scratch) - keep;
+        if(length > size - offset) length = size - offset;
+        if(klfs_pread(fd, offset, length, klfs_scratch + keep) != (i32)length) {
+            grep->failed = true;
+            break;
+        }
+        offset += length;
+        grep->bytes += length;
+        grep->kb += grep->bytes / 1024;
+        grep->bytes %= 1024;
+
+        u32 have = keep + length;
+        u32 pos = 0;
+        while(pos + m <= have) {
+            u8 last = klfs_scratch[pos + m - 1];
+            if(last == pattern[m - 1]) {
+                u32 i = 0;
+                while(i < m - 1 && klfs_scratch[pos + i] == pattern[i]) i++;
+                if(i == m - 1) klfs_grep_report(grep, name, base + pos, klfs_scratch + pos, have - pos);
+            }
+            pos += grep->skip[last];
+        }
+
+        // Windows not yet tried start at pos; keep those bytes for the next read
+        keep = pos < have ? have - pos : 0;
+        for(u32 i = 0; i < keep; i++) klfs_scratch[i] = klfs_scratch[pos + i];
+        base += have - keep;
+    }
+    klfs_close(fd);
+    grep->files++;
+}
+
+static void klfs_grep_visit(const klfs_file_entry_t* file, void* context) {
+    klfs_grep_t* grep = (klfs_grep_t*)context;
+    if(klfs_glob(grep->files_pattern, file->name, false)) klfs_grep_file(grep, file->name);
+}
+
+// Search one file, or every file matching a glob, for some text
+bool klfs_grep(const char* text, const char* files) {
+    klfs_superblock_t sb;
+    klfs_grep_t grep;
+
+    u32 m = 0;
+    while(text[m]) m++;
+    if(m == 0 || m > KLFS_GREP_MAX) {
+        kprint("Error: Search text must be 1 to "); kprint_dec(KLFS_GREP_MAX); kprint(" characters\n");
+        return false;
+    }
+    if(!klfs_load_super(&sb)) return false;
+
+    grep.pattern = (const u8*)text;
+    grep.length = m;
+    grep.files_pattern = files;
+    grep.matches = grep.files = grep.kb = grep.bytes = 0;
+    grep.failed = false;
+    for(u32 i = 0; i < 256; i++) grep.skip[i] = m;
+    for(u32 i = 0; i < m - 1; i++) grep.skip[grep.pattern[i]] = m - 1 - i;
+
+    u32 start = timer_ticks;
+    if(klfs_is_glob(files)) {
+        if(!klfs_dir_walk(&sb, klfs_grep_visit, &grep)) return false;
+    } else {
+        klfs_grep_file(&grep, files);
+    }
+    u32 ticks = timer_ticks - start;
+    if(grep.failed && grep.files == 0) return false;
+
+    if(grep.matches > KLFS_GREP_SHOW) {
+        kprint("... and "); kprint_dec(grep.matches - KLFS_GREP_SHOW); kprint(" more\n");
+    }
+    kprint_dec(grep.matches); kprint(grep.matches == 1 ? " match in " : " matches in ");
+    kprint_dec(grep.files); kprint(grep.files == 1 ? " file, " : " files, ");
+    kprint_dec(grep.kb); kprint(" KB in ");
+    klfs_print_rate(grep.kb, ticks);
+    kprint("\n");
+    return !grep.failed;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: klfs.h
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Header file for KLFS, the filesystem.
+    Dependencies: types.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#pragma once
+#include "types.h"
+
+// Block I/O in 1KB filesystem blocks, through the block cache
+bool read_block(u32 block_num, void* buffer);
+bool write_block(u32 block_num, void* buffer);
+bool read_blocks(u32 block_num, u32 count, void* buffer);
+bool write_blocks(u32 block_num, u32 count, const void* buffer);
+
+void klfs_format(u32 blocks);
+bool klfs_mount(void);
+bool klfs_umount(void);
+void klfs_invalidate(void);
+bool klfs_sync(void);
+
+// Periodic flush: the main loop calls klfs_flush every KLFS_FLUSH_SECONDS to
+// write back whatever is pending
+#define KLFS_FLUSH_SECONDS 5
+bool klfs_flush(void);
+bool klfs_verify();  // False if any check fails
+void klfs_list_files();
+bool klfs_create_file(const char* filename);
+bool klfs_write_file(const char* filename, const char* data);
+bool klfs_read_file(const char* filename);
+bool klfs_delete_file(const char* filename);
+void klfs_find_file(const char* pattern);
+bool klfs_grep(const char* text, const char* files);
+bool klfs_copy_file(const char* source, const char* dest);
+bool klfs_append_file(const char* filename, const char* data);
+bool klfs_compress_file(const char* filename, bool compress);
+
+// File handle API: byte offsets and lengths, so files can hold binary data
+i32 klfs_open(const char* filename, bool create);
+bool klfs_close(i32 fd);
+u32 klfs_size(i32 fd);
+i32 klfs_pread(i32 fd, u32 offset, u32 length, void* buffer);
+i32 klfs_pwrite(i32 fd, u32 offset, u32 length, const void* buffer);
+bool klfs_truncate(i32 fd, u32 size);
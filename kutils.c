@@ -115,6 +115,18 @@ u32 str_to_uint(const char* str) {
     return result;
 }
 
+// PIT Timer Functions
+volatile u32 timer_ticks = 0;
+
+void timer_init(u32 frequency) {
+    u32 div = 1193180 / frequency;
+
+    timer_ticks = 0;
+    outb(0x43, 0x36);              // Channel 0, lobyte/hibyte, square wave
+    outb(0x40, (u8)(div));
+    outb(0x40, (u8)(div >> 8));
+}
+
 // RTC Reading Functions
 u8 read_cmos(u8 address) {
     outb(0x70, 0x0A);
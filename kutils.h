@@ -47,6 +47,11 @@ u8 get_rtc_hours();
 u8 get_rtc_day(); 
 u8 get_rtc_year();     
 u8 get_rtc_month();
+
+// PIT channel 0 tick counter, advanced by IRQ 0
+#define TIMER_HZ 100
+extern volatile u32 timer_ticks;
+void timer_init(u32 frequency);
 void outb(u16 port, u8 val);
 u8 inb(u16 port);
 static inline u16 inw(u16 port) {
@@ -57,4 +62,32 @@ static inline u16 inw(u16 port) {
 
 static inline void outw(u16 port, u16 val) {
     __asm__ volatile ("outw %0, %1" : : "a"(val), "Nd"(port));
-}
\ No newline at end of file
+}
+
+static inline u32 inl(u16 port) {
+    u32 ret;
+    __asm__ volatile ("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void outl(u16 port, u32 val) {
+    __asm__ volatile ("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
+// String I/O: move count words (or dwords) between a port and memory with a
+// single rep instruction, instead of one in/out per element
+static inline void insw(u16 port, void* buffer, u32 count) {
+    __asm__ volatile ("rep insw" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline void outsw(u16 port, const void* buffer, u32 count) {
+    __asm__ volatile ("rep outsw" : "+S"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline void insl(u16 port, void* buffer, u32 count) {
+    __asm__ volatile ("rep insl" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline void outsl(u16 port, const void* buffer, u32 count) {
+    __asm__ volatile ("rep outsl" : "+S"(buffer), "+c"(count) : "d"(port) : "memory");
+}
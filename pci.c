@@ -0,0 +1,121 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: pci.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: To access PCI configuration space and find devices by class.
+    Dependencies: types.h, kutils.h, pci.h
+
+    Suggested Changes/Todo:
+    Add an "lspci" style listing command.
+
+*/
+
+#include "types.h"
+#include "kutils.h"
+#include "pci.h"
+
+// Build a configuration mechanism #1 address (enable bit + bus/slot/func/register)
+static u32 pci_address(u8 bus, u8 slot, u8 func, u8 offset) {
+    return 0x80000000 | ((u32)bus << 16) | ((u32)(slot & 0x1F) << 11) |
+           ((u32)(func & 0x07) << 8) | (offset & 0xFC);
+}
+
+u32 pci_config_read32(u8 bus, u8 slot, u8 func, u8 offset) {
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_config_write32(u8 bus, u8 slot, u8 func, u8 offset, u32 value) {
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+u16 pci_config_read16(u8 bus, u8 slot, u8 func, u8 offset) {
+    u32 value = pci_config_read32(bus, slot, func, offset);
+    return (value >> ((offset & 2) * 8)) & 0xFFFF;
+}
+
+void pci_config_write16(u8 bus, u8 slot, u8 func, u8 offset, u16 value) {
+    u32 old = pci_config_read32(bus, slot, func, offset);
+    u32 shift = (offset & 2) * 8;
+    old &= ~(0xFFFF << shift);
+    old |= (u32)value << shift;
+    pci_config_write32(bus, slot, func, offset, old);
+}
+
+// Brute-force scan of every bus/slot/function for the first device that has
+// the given vendor/device ID (by_id) or class/subclass (otherwise)
+static bool pci_scan(bool by_id, u32 want_id, u8 class_code, u8 subclass, pci_device_t* out) {
+    for(u32 bus = 0; bus < 256; bus++) {
+        for(u8 slot = 0; slot < 32; slot++) {
+            for(u8 func = 0; func < 8; func++) {
+                u32 id = pci_config_read32(bus, slot, func, PCI_VENDOR_ID);
+                if((id & 0xFFFF) == 0xFFFF) {
+                    if(func == 0) break;  // No device in this slot at all
+                    continue;
+                }
+
+                u32 class_rev = pci_config_read32(bus, slot, func, PCI_CLASS_REVISION);
+                bool match = by_id ? (id == want_id)
+                                   : ((class_rev >> 24) == class_code && ((class_rev >> 16) & 0xFF) == subclass);
+                if(match) {
+                    out->bus = bus;
+                    out->slot = slot;
+                    out->func = func;
+                    out->vendor_id = id & 0xFFFF;
+                    out->device_id = id >> 16;
+                    out->class_code = class_rev >> 24;
+                    out->subclass = (class_rev >> 16) & 0xFF;
+                    out->prog_if = (class_rev >> 8) & 0xFF;
+                    return true;
+                }
+
+                // Only scan functions 1-7 on multi-function devices
+                if(func == 0) {
+                    u32 header = pci_config_read32(bus, slot, 0, PCI_HEADER_TYPE & 0xFC);
+                    if(!((header >> 16) & 0x80)) break;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool pci_find_class(u8 class_code, u8 subclass, pci_device_t* out) {
+    return pci_scan(false, 0, class_code, subclass, out);
+}
+
+bool pci_find_device(u16 vendor_id, u16 device_id, pci_device_t* out) {
+    return pci_scan(true, ((u32)device_id << 16) | vendor_id, 0, 0, out);
+}
+
+u32 pci_read_bar(pci_device_t* dev, u8 bar) {
+    return pci_config_read32(dev->bus, dev->slot, dev->func, PCI_BAR0 + bar * 4);
+}
+
+void pci_enable_bus_master(pci_device_t* dev) {
+    u16 command = pci_config_read16(dev->bus, dev->slot, dev->func, PCI_COMMAND);
+    command |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER;
+    pci_config_write16(dev->bus, dev->slot, dev->func, PCI_COMMAND, command);
+}
+
+// Legacy interrupt line the BIOS routed the device's INTx pin to (0xFF if none)
+u8 pci_interrupt_line(pci_device_t* dev) {
+    return pci_config_read32(dev->bus, dev->slot, dev->func, PCI_INTERRUPT_LINE) & 0xFF;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: pci.h
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Header file for PCI configuration space access.
+    Dependencies: types.h
+
+    Suggested Changes/Todo:
+    Add an "lspci" style listing command.
+
+*/
+
+#pragma once
+#include "types.h"
+
+// PCI configuration mechanism #1 ports
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+// Configuration space offsets
+#define PCI_VENDOR_ID      0x00
+#define PCI_COMMAND        0x04
+#define PCI_CLASS_REVISION 0x08
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_INTERRUPT_LINE 0x3C
+
+// Command register bits
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_BUS_MASTER  0x0004
+
+typedef struct {
+    u8 bus;
+    u8 slot;
+    u8 func;
+    u16 vendor_id;
+    u16 device_id;
+    u8 class_code;
+    u8 subclass;
+    u8 prog_if;
+} pci_device_t;
+
+u32 pci_config_read32(u8 bus, u8 slot, u8 func, u8 offset);
+void pci_config_write32(u8 bus, u8 slot, u8 func, u8 offset, u32 value);
+u16 pci_config_read16(u8 bus, u8 slot, u8 func, u8 offset);
+void pci_config_write16(u8 bus, u8 slot, u8 func, u8 offset, u16 value);
+bool pci_find_class(u8 class_code, u8 subclass, pci_device_t* out);
+bool pci_find_device(u16 vendor_id, u16 device_id, pci_device_t* out);
+u32 pci_read_bar(pci_device_t* dev, u8 bar);
+void pci_enable_bus_master(pci_device_t* dev);
+u8 pci_interrupt_line(pci_device_t* dev);
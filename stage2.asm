@@ -28,6 +28,11 @@
 [ORG 0x8000]
 [BITS 16]
 
+; Kernel size in sectors, normally passed in by the Makefile (-DKERNEL_SECTORS=n)
+%ifndef KERNEL_SECTORS
+%define KERNEL_SECTORS 192
+%endif
+
 stage2_start:
     ; Save boot drive
     mov [boot_drive], dl
@@ -61,10 +66,10 @@ load_kernel:
     jc kernel_error
 
     ; We'll load the kernel in smaller chunks to avoid BIOS limitations
-    ; Start loading at 0x1000
-    mov ax, 0x0100
+    ; Start loading at 0x10000, clear of this bootloader at 0x8000
+    mov ax, 0x1000
     mov es, ax
-    xor bx, bx              ; ES:BX = 0x0100:0x0000 = 0x1000
+    xor bx, bx              ; ES:BX = 0x1000:0x0000 = 0x10000
 
     ; Kernel starts at sector 10 (after stage2) 
     mov byte [current_sector], 10
@@ -91,8 +96,8 @@ load_kernel:
     call print_string
 
 .load_loop:
-    ; Check if we've loaded enough (48 sectors - kernel needs more than 36)
-    cmp word [sectors_loaded], 48
+    ; Check if we've loaded the whole kernel
+    cmp word [sectors_loaded], KERNEL_SECTORS
     jae .done_loading
 
     ; Read one sector at a time (safe CHS handling)
@@ -270,7 +275,7 @@ protected_mode_start:
     
     ; Jump to kernel
         ; Far jump to kernel entry (set CS)
-        jmp 0x08:0x1000
+        jmp 0x08:0x10000
 
 [BITS 16]
 ; Utility functions
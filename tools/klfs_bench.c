@@ -0,0 +1,159 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: klfs_bench.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: KLFS microbenchmark on a disk image: klfs-bench <image> [files].
+             Formats the image, so don't point it at one you want to keep.
+    Dependencies: types.h, klfs.h, klfs_host.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "klfs.h"
+#include "klfs_host.h"
+
+#define BENCH_IMAGE_BASE (32ULL * 1024 * 1024)
+#define BENCH_PER_FILE   (8 * 1024)  // Data, extent map and a share of the directory
+#define BENCH_FILE_SIZE  4096
+#define BENCH_SEQ_SIZE   (16 * 1024 * 1024)
+#define BENCH_SEQ_CHUNK  (64 * 1024)
+
+static char bench_buffer[BENCH_SEQ_CHUNK];
+static char bench_check[BENCH_SEQ_CHUNK];
+
+static void bench_name(char* name, u32 i) {
+    snprintf(name, 32, "f%05u", i);
+}
+
+static void bench_fill(char* buffer, u32 length, u32 seed) {
+    for(u32 i = 0; i < length; i++) buffer[i] = (char)(seed * 31 + i / 7);
+}
+
+static void bench_report(const char* what, double start, u32 ops, u64 bytes) {
+    double elapsed = host_seconds() - start;
+    if(elapsed <= 0) elapsed = 1e-9;
+    printf("%-24s %8.3f s %10.0f ops/s", what, elapsed, ops / elapsed);
+    if(bytes) printf(" %8.1f MB/s", bytes / elapsed / (1024 * 1024));
+    printf("\n");
+}
+
+static bool bench_fail(const char* what, u32 i) {
+    fprintf(stderr, "klfs-bench: %s failed at %u\n", what, i);
+    host_close();
+    return false;
+}
+
+static bool bench_run(u32 files) {
+    char name[32];
+    double start;
+
+    start = host_seconds();
+    for(u32 i = 0; i < files; i++) {
+        bench_name(name, i);
+        i32 fd = klfs_open(name, true);
+        if(fd < 0 || !klfs_close(fd)) return bench_fail("create", i);
+    }
+    if(!klfs_sync()) return bench_fail("sync", files);
+    bench_report("create", start, files, 0);
+
+    start = host_seconds();
+    for(u32 i = 0; i < files; i++) {
+        bench_name(name, i);
+        bench_fill(bench_buffer, BENCH_FILE_SIZE, i);
+        i32 fd = klfs_open(name, false);
+        if(fd < 0) return bench_fail("open", i);
+        bool ok = klfs_pwrite(fd, 0, BENCH_FILE_SIZE, bench_buffer) == BENCH_FILE_SIZE;
+        if(!klfs_close(fd) || !ok) return bench_fail("write", i);
+    }
+    if(!klfs_sync()) return bench_fail("sync", files);
+    bench_report("write 4K files", start, files, (u64)files * BENCH_FILE_SIZE);
+
+    start = host_seconds();
+    for(u32 i = 0; i < files; i++) {
+        bench_name(name, i);
+        bench_fill(bench_check, BENCH_FILE_SIZE, i);
+        i32 fd = klfs_open(name, false);
+        if(fd < 0) return bench_fail("open", i);
+        bool ok = klfs_pread(fd, 0, BENCH_FILE_SIZE, bench_buffer) == BENCH_FILE_SIZE;
+        if(!klfs_close(fd) || !ok) return bench_fail("read", i);
+        if(memcmp(bench_buffer, bench_check, BENCH_FILE_SIZE) != 0) return bench_fail("verify", i);
+    }
+    bench_report("read 4K files", start, files, (u64)files * BENCH_FILE_SIZE);
+
+    i32 fd = klfs_open("sequential", true);
+    if(fd < 0) return bench_fail("create", 0);
+    start = host_seconds();
+    for(u32 offset = 0; offset < BENCH_SEQ_SIZE; offset += BENCH_SEQ_CHUNK) {
+        bench_fill(bench_buffer, BENCH_SEQ_CHUNK, offset / BENCH_SEQ_CHUNK);
+        if(klfs_pwrite(fd, offset, BENCH_SEQ_CHUNK, bench_buffer) != BENCH_SEQ_CHUNK) return bench_fail("sequential write", offset);
+    }
+    if(!klfs_sync()) return bench_fail("sync", 0);
+    bench_report("sequential write 16M", start, BENCH_SEQ_SIZE / BENCH_SEQ_CHUNK, BENCH_SEQ_SIZE);
+
+    start = host_seconds();
+    for(u32 offset = 0; offset < BENCH_SEQ_SIZE; offset += BENCH_SEQ_CHUNK) {
+        if(klfs_pread(fd, offset, BENCH_SEQ_CHUNK, bench_buffer) != BENCH_SEQ_CHUNK) return bench_fail("sequential read", offset);
+        bench_fill(bench_check, BENCH_SEQ_CHUNK, offset / BENCH_SEQ_CHUNK);
+        if(memcmp(bench_buffer, bench_check, BENCH_SEQ_CHUNK) != 0) return bench_fail("verify", offset);
+    }
+    bench_report("sequential read 16M", start, BENCH_SEQ_SIZE / BENCH_SEQ_CHUNK, BENCH_SEQ_SIZE);
+    if(!klfs_close(fd)) return bench_fail("close", 0);
+
+    // klfs_delete_file reports every file it deletes
+    FILE* console = host_console;
+    host_console = fopen("/dev/null", "w");
+    start = host_seconds();
+    u32 deleted = 0;
+    while(deleted < files) {
+        bench_name(name, deleted);
+        if(!klfs_delete_file(name)) break;
+        deleted++;
+    }
+    bool synced = klfs_sync();
+    if(host_console) fclose(host_console);
+    host_console = console;
+    if(deleted < files || !synced) return bench_fail("delete", deleted);
+    bench_report("delete", start, files, 0);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if(argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: klfs-bench <image> [files]\n");
+        fprintf(stderr, "Creates or reformats the image; [files] small files (default 2000).\n");
+        return 1;
+    }
+
+    u32 files = argc == 3 ? (u32)strtoul(argv[2], 0, 10) : 2000;
+    if(files == 0 || files > 10000) {
+        fprintf(stderr, "klfs-bench: files must be 1 to 10000\n");
+        return 1;
+    }
+
+    if(!host_open(argv[1], BENCH_IMAGE_BASE + (u64)files * BENCH_PER_FILE)) return 1;
+    klfs_format(0);
+    if(!bench_run(files)) return 1;
+    return host_close() ? 0 : 1;
+}
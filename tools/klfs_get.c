@@ -0,0 +1,76 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: klfs_get.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Copies a file out of a KLFS disk image: klfs-get <image> <name> [dest]
+    Dependencies: types.h, klfs.h, klfs_host.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#include <stdio.h>
+#include "types.h"
+#include "klfs.h"
+#include "klfs_host.h"
+
+#define GET_CHUNK (64 * 1024)
+
+static char get_buffer[GET_CHUNK];
+
+int main(int argc, char** argv) {
+    if(argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: klfs-get <image> <name> [dest]\n");
+        fprintf(stderr, "Without a destination the file goes to stdout.\n");
+        return 1;
+    }
+
+    // The file may be going to stdout, so KLFS messages must not
+    host_console = stderr;
+    if(!host_open(argv[1], 0)) return 1;
+
+    i32 fd = klfs_open(argv[2], false);
+    if(fd < 0) {
+        host_close();
+        return 1;
+    }
+
+    FILE* out = argc == 4 ? fopen(argv[3], "wb") : stdout;
+    if(!out) {
+        perror(argv[3]);
+        klfs_close(fd);
+        host_close();
+        return 1;
+    }
+
+    u32 size = klfs_size(fd);
+    bool ok = true;
+    for(u32 offset = 0; ok && offset < size; ) {
+        u32 length = size - offset < GET_CHUNK ? size - offset : GET_CHUNK;
+        i32 got = klfs_pread(fd, offset, length, get_buffer);
+        ok = got > 0 && fwrite(get_buffer, 1, (size_t)got, out) == (size_t)got;
+        offset += got > 0 ? (u32)got : 0;
+    }
+    if(fflush(out) != 0 || (out != stdout && fclose(out) != 0)) ok = false;
+    if(!ok) fprintf(stderr, "klfs-get: failed to copy %s\n", argv[2]);
+
+    klfs_close(fd);
+    return host_close() && ok ? 0 : 1;
+}
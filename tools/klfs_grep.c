@@ -0,0 +1,43 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: klfs_grep.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Searches files in a KLFS disk image: klfs-grep <image> <text> <file or pattern>
+    Dependencies: types.h, klfs.h, klfs_host.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#include <stdio.h>
+#include "types.h"
+#include "klfs.h"
+#include "klfs_host.h"
+
+int main(int argc, char** argv) {
+    if(argc != 4) {
+        fprintf(stderr, "Usage: klfs-grep <image> <text> <file or pattern, e.g. \"*.log\">\n");
+        return 1;
+    }
+
+    if(!host_open(argv[1], 0)) return 1;
+    bool ok = klfs_grep(argv[2], argv[3]);
+    return host_close() && ok ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: klfs_host.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Runs KLFS on Linux: a block device backed by an image file, and
+             the few kernel services klfs.c, bcache.c and blkq.c call.
+    Dependencies: types.h, vga.h, kutils.h, klfs.h, bcache.h, blkq.h, klfs_host.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "types.h"
+#include "vga.h"
+#include "kutils.h"
+#include "klfs.h"
+#include "bcache.h"
+#include "blkq.h"
+#include "klfs_host.h"
+
+FILE* host_console = 0;
+volatile u32 timer_ticks = 0;  // Counted up TIMER_HZ times a second, like the PIT does
+
+static void host_tick(int signal) {
+    (void)signal;
+    timer_ticks++;
+}
+
+void kprint(const char* str) {
+    fputs(str, host_console ? host_console : stdout);
+}
+
+void kprint_bytes(const char* data, u32 length) {
+    fwrite(data, 1, length, host_console ? host_console : stdout);
+}
+
+void kprint_dec(u32 num) {
+    fprintf(host_console ? host_console : stdout, "%u", num);
+}
+
+void kprint_hex(u8 num) {
+    fprintf(host_console ? host_console : stdout, "%02X", num);
+}
+
+bool str_equals(const char* a, const char* b) {
+    return strcmp(a, b) == 0;
+}
+
+static int host_fd = -1;
+static blkdev_t host_dev;
+
+// Commands complete before start returns, so the queue never has to wait
+static bool host_start(blkdev_t* dev, blk_cmd_t* cmd) {
+    (void)dev;
+    off_t offset = (off_t)cmd->lba * 512;
+    bool ok = true;
+
+    for(u32 i = 0; i < cmd->nsegs && ok; i++) {
+        size_t length = (size_t)cmd->segs[i].count * 512;
+        ssize_t done = cmd->write ? pwrite(host_fd, cmd->segs[i].buffer, length, offset)
+                                  : pread(host_fd, cmd->segs[i].buffer, length, offset);
+        ok = done == (ssize_t)length;
+        offset += length;
+    }
+    blkq_complete(cmd, ok);
+    return true;
+}
+
+// The journal orders its writes with flushes. An image is only written by
+// one tool at a time and synced when it's closed, so the page cache already
+// gives every reader the order KLFS wrote in.
+static bool host_flush(blkdev_t* dev) {
+    (void)dev;
+    return true;
+}
+
+bool host_open(const char* path, u64 create_size) {
+    host_fd = open(path, create_size ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if(host_fd < 0) {
+        perror(path);
+        return false;
+    }
+    if(create_size && ftruncate(host_fd, (off_t)create_size) != 0) {
+        perror(path);
+        return false;
+    }
+
+    off_t size = lseek(host_fd, 0, SEEK_END);
+    if(size < 0) {
+        perror(path);
+        return false;
+    }
+
+    strcpy(host_dev.name, "img");
+    host_dev.sectors = (u64)size / 512;
+    host_dev.max_inflight = 1;
+    host_dev.polled = true;
+    host_dev.start = host_start;
+    host_dev.flush = host_flush;
+
+    struct sigaction tick = {0};
+    tick.sa_handler = host_tick;
+    tick.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &tick, 0);
+    struct itimerval period = {{0, 1000000 / TIMER_HZ}, {0, 1000000 / TIMER_HZ}};
+    setitimer(ITIMER_REAL, &period, 0);
+
+    blkq_init();
+    bcache_init();
+    blkdev_register(&host_dev);
+    return true;
+}
+
+bool host_close(void) {
+    bool ok = klfs_sync();
+    if(fsync(host_fd) != 0) {
+        perror("fsync");
+        ok = false;
+    }
+    close(host_fd);
+    host_fd = -1;
+    return ok;
+}
+
+u64 host_parse_size(const char* text) {
+    char* end;
+    u64 size = strtoull(text, &end, 10);
+    if(end == text) return 0;
+    switch(*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+    }
+    return *end ? 0 : size;
+}
+
+double host_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
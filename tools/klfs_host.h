@@ -0,0 +1,48 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: klfs_host.h
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Header file for running KLFS on Linux against a disk image file.
+    Dependencies: types.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#pragma once
+#include <stdio.h>
+#include "types.h"
+
+// Where kprint output goes (stdout unless a tool needs stdout for data)
+extern FILE* host_console;
+
+// Open an image file as the root block device and set up the block layer.
+// create_size > 0 creates the file, or resizes it, to that many bytes.
+bool host_open(const char* path, u64 create_size);
+
+// Commit KLFS, write back the block cache and sync the image file
+bool host_close(void);
+
+// Parse a size such as 4096, 512K, 64M or 2G (plain numbers are bytes).
+// Returns 0 if it isn't one.
+u64 host_parse_size(const char* text);
+
+// Monotonic time in seconds, for rates
+double host_seconds(void);
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: klfs_put.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Copies host files into a KLFS disk image: klfs-put [-z] <image> <files...>
+    Dependencies: types.h, klfs.h, klfs_host.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "types.h"
+#include "klfs.h"
+#include "klfs_host.h"
+
+#define PUT_CHUNK (64 * 1024)
+
+static char put_buffer[PUT_CHUNK];
+
+// Store one host file under its base name, compressed if asked. Returns its
+// size, or -1.
+static long long put_file(const char* path, bool compress) {
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    if(!*name || strlen(name) > 31) {
+        fprintf(stderr, "klfs-put: %s: name must be 1 to 31 characters\n", path);
+        return -1;
+    }
+
+    FILE* in = fopen(path, "rb");
+    if(!in) {
+        perror(path);
+        return -1;
+    }
+
+    i32 fd = klfs_open(name, true);
+    if(fd < 0) {
+        fclose(in);
+        return -1;
+    }
+
+    u32 offset = 0;
+    bool ok = true;
+    size_t got;
+    while(ok && (got = fread(put_buffer, 1, PUT_CHUNK, in)) > 0) {
+        if(offset + got < offset) {
+            fprintf(stderr, "klfs-put: %s: too big for KLFS\n", path);
+            ok = false;
+            break;
+        }
+        ok = klfs_pwrite(fd, offset, (u32)got, put_buffer) == (i32)got;
+        offset += got;
+    }
+    if(ferror(in)) {
+        perror(path);
+        ok = false;
+    }
+
+    // Replacing a longer file: drop its old tail
+    ok = ok && klfs_truncate(fd, offset);
+    ok = klfs_close(fd) && ok;
+    ok = ok && (!compress || klfs_compress_file(name, true));
+    fclose(in);
+    return ok ? (long long)offset : -1;
+}
+
+int main(int argc, char** argv) {
+    bool compress = argc > 1 && strcmp(argv[1], "-z") == 0;
+    if(compress) {
+        argc--;
+        argv++;
+    }
+    if(argc < 3) {
+        fprintf(stderr, "Usage: klfs-put [-z] <image> <files...>\n");
+        return 1;
+    }
+
+    if(!host_open(argv[1], 0)) return 1;
+
+    double start = host_seconds();
+    long long total = 0;
+    int stored = 0, failed = 0;
+    for(int i = 2; i < argc; i++) {
+        long long size = put_file(argv[i], compress);
+        if(size < 0) {
+            failed++;
+            continue;
+        }
+        total += size;
+        stored++;
+    }
+    bool ok = host_close();
+    double elapsed = host_seconds() - start;
+
+    printf("Stored %d file(s), %lld KB in %.2f s", stored, total / 1024, elapsed);
+    if(failed) printf(", %d failed", failed);
+    printf("\n");
+    return ok && !failed ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: mkklfs.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Creates a KLFS disk image: mkklfs <image> [size]
+    Dependencies: types.h, klfs.h, klfs_host.h
+
+    Suggested Changes/Todo:
+    Nothing yet.
+
+*/
+
+#include <stdio.h>
+#include "types.h"
+#include "klfs.h"
+#include "klfs_host.h"
+
+int main(int argc, char** argv) {
+    if(argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: mkklfs <image> [size[K|M|G]]\n");
+        fprintf(stderr, "With a size the image is created or resized, otherwise all of it is used.\n");
+        return 1;
+    }
+
+    u64 size = 0;
+    if(argc == 3) {
+        size = host_parse_size(argv[2]);
+        if(size < 1024 * 1024) {
+            fprintf(stderr, "mkklfs: bad size '%s' (at least 1M)\n", argv[2]);
+            return 1;
+        }
+    }
+
+    if(!host_open(argv[1], size)) return 1;
+    klfs_format(0);
+    return host_close() ? 0 : 1;
+}
@@ -47,33 +47,43 @@ void scroll_screen() {
     }
 }
 
-void kprint(const char* str){
+// Put one character on screen without moving the hardware cursor
+static void vga_putc(char c) {
     u16* VGA_MEMORY = (u16*) (0xB8000);
-    
-    for(u32 i = 0; str[i] != '\0'; i++){
-        if(str[i] == '\n'){
+
+    if(c == '\n'){
+        row++;
+        col = 0;
+    } else{
+        VGA_MEMORY[row * 80 + col] = (u8)c | (VGA_COLOR(VGA_BLACK, VGA_WHITE) << 8);
+        col++;
+        if(col >= 80) {  // Wrap to next line
             row++;
             col = 0;
-            update_cursor(row, col);
-        } else{
-            VGA_MEMORY[row * 80 + col] = (str[i]) | (VGA_COLOR(VGA_BLACK, VGA_WHITE) << 8);
-            col++;
-            if(col >= 80) {  // Wrap to next line
-                row++;
-                col = 0;
-                update_cursor(row, col);
-            }
         }
+    }
 
-        if(row >= 25) {
-            // Time to scroll!
-            scroll_screen();
-            row = 24;  // Move to last line
-            col = 0;
-            update_cursor(row, col);
-        }
-        update_cursor(row, col);  // <-- ADD THIS
+    if(row >= 25) {
+        // Time to scroll!
+        scroll_screen();
+        row = 24;  // Move to last line
+        col = 0;
+    }
+}
+
+void kprint(const char* str){
+    for(u32 i = 0; str[i] != '\0'; i++){
+        vga_putc(str[i]);
+    }
+    update_cursor(row, col);  // Once per string: each update is four port writes
+}
+
+// Print exactly length bytes. NULs and everything else are shown as they are.
+void kprint_bytes(const char* data, u32 length){
+    for(u32 i = 0; i < length; i++){
+        vga_putc(data[i]);
     }
+    update_cursor(row, col);
 }
 void klear(){
     u16* VGA_MEMORY = (u16*) (0xB8000);
@@ -51,6 +51,7 @@ typedef enum {
 #define VGA_COLOR(bg, fg) ((bg << 4) | fg)
 
 void kprint(const char* str);
+void kprint_bytes(const char* data, u32 length);
 void klear(void);
 void kprint_isr(const char* str);
 void kprint_hex(u8 value);
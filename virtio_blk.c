@@ -0,0 +1,359 @@
+/*
+ * Copyright 2025 Joseph Jones
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    File: virtio_blk.c
+    Created on: October 16th 2026
+    Created by: jjones (GitHub Username: KlondikeDev)
+    Purpose: Driver for QEMU's virtio-blk disk (legacy PCI interface).
+    Dependencies: types.h, vga.h, idt.h, kutils.h, pci.h, blkq.h, virtio_blk.h
+
+    Suggested Changes/Todo:
+    Only the first virtio-blk device is used, through the legacy (0.9.5) I/O
+    port interface that QEMU's transitional device offers by default.
+
+*/
+
+/*
+ * The device has one split virtqueue: a descriptor table, the avail ring we
+ * add requests to and the used ring the device returns them on. A request is
+ * a chain of a header (type and sector), one descriptor per data segment and
+ * a status byte the device fills in. When the device offers indirect
+ * descriptors each request's chain lives in its own table and takes a single
+ * slot in the ring; otherwise the chain is laid out in the ring itself.
+ *
+ * Requests started in one pass of the block queue are all added to the avail
+ * ring first, and the device is notified once for the batch (blkq's kick).
+ * Completions come back on the used ring, picked up after the interrupt or
+ * by polling when the interrupt line can't be hooked.
+ */
+
+#include "types.h"
+#include "vga.h"
+#include "idt.h"
+#include "kutils.h"
+#include "pci.h"
+#include "blkq.h"
+#include "virtio_blk.h"
+
+#define VIRTIO_VENDOR_ID      0x1AF4
+#define VIRTIO_BLK_DEVICE_ID  0x1001  // Transitional virtio-blk
+
+// Legacy virtio PCI registers (offsets from BAR0, I/O space)
+#define VIRTIO_DEVICE_FEATURES 0x00
+#define VIRTIO_GUEST_FEATURES  0x04
+#define VIRTIO_QUEUE_PFN       0x08
+#define VIRTIO_QUEUE_SIZE      0x0C
+#define VIRTIO_QUEUE_SELECT    0x0E
+#define VIRTIO_QUEUE_NOTIFY    0x10
+#define VIRTIO_DEVICE_STATUS   0x12
+#define VIRTIO_ISR_STATUS      0x13
+#define VIRTIO_BLK_CAPACITY    0x14  // Device config, right after the common registers without MSI-X
+
+#define VIRTIO_STATUS_ACK       1
+#define VIRTIO_STATUS_DRIVER    2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FAILED    128
+
+#define VIRTIO_BLK_F_RO        (1u << 5)
+#define VIRTIO_BLK_F_FLUSH     (1u << 9)
+#define VIRTIO_F_INDIRECT_DESC (1u << 28)
+
+#define VIRTQ_DESC_F_NEXT      1
+#define VIRTQ_DESC_F_WRITE     2  // The device writes this buffer
+#define VIRTQ_DESC_F_INDIRECT  4
+#define VIRTQ_USED_F_NO_NOTIFY 1
+
+#define VIRTIO_BLK_T_IN    0
+#define VIRTIO_BLK_T_OUT   1
+#define VIRTIO_BLK_T_FLUSH 4
+
+#define VIRTIO_QUEUE_MAX  256                     // Largest ring we have memory for
+#define VIRTIO_REQUESTS   16                      // Requests in flight at most
+#define VIRTIO_REQ_DESCS  (BLKQ_MAX_SEGMENTS + 2) // Header, data segments, status
+#define VIRTIO_TIMEOUT_TICKS (5 * TIMER_HZ)
+
+typedef struct {
+    u64 addr;
+    u32 len;
+    u16 flags;
+    u16 next;
+} PACKED virtq_desc_t;
+
+typedef struct {
+    u16 flags;
+    u16 idx;
+    u16 ring[];
+} PACKED virtq_avail_t;
+
+typedef struct {
+    u32 id;
+    u32 len;
+} PACKED virtq_used_elem_t;
+
+typedef struct {
+    u16 flags;
+    u16 idx;
+    virtq_used_elem_t ring[];
+} PACKED virtq_used_t;
+
+typedef struct {
+    u32 type;
+    u32 reserved;
+    u64 sector;
+} PACKED virtio_blk_header_t;
+
+typedef struct {
+    virtq_desc_t table[VIRTIO_REQ_DESCS];  // The chain, when using indirect descriptors
+    virtio_blk_header_t header;
+    volatile u8 status;
+    blk_cmd_t* cmd;                        // 0 for the driver's own flush
+} virtio_request_t;
+
+typedef struct {
+    u16 io_base;
+    u16 queue_size;
+    bool indirect;
+    bool flush;                  // Device has a write cache that needs flushing
+    bool read_only;
+    volatile virtq_desc_t* desc;
+    volatile virtq_avail_t* avail;
+    volatile virtq_used_t* used;
+    u16 avail_idx;               // Next avail slot, published to the device
+    u16 used_idx;                // Next used entry we haven't looked at
+    u32 busy;                    // Request slots in use
+    u32 depth;
+    u64 capacity;
+    blkdev_t dev;
+} virtio_blk_t;
+
+// Three pages are enough for a 256-entry legacy ring (descriptors and avail
+// ring, then the used ring on its own page boundary)
+static u8 virtio_ring[3 * 4096] __attribute__((aligned(4096)));
+static virtio_request_t virtio_requests[VIRTIO_REQUESTS] __attribute__((aligned(16)));
+static virtio_blk_t virtio_blk;
+
+static inline void virtio_barrier(void) {
+    __asm__ volatile("" ::: "memory");  // x86 keeps stores in order; stop the compiler reordering them
+}
+
+static void virtio_set_desc(volatile virtq_desc_t* d, void* addr, u32 len, u16 flags, u16 next) {
+    d->addr = (u32)addr;
+    d->len = len;
+    d->flags = flags;
+    d->next = next;
+}
+
+// Lay out request slot r and put it on the avail ring. The device isn't told
+// until virtio_blk_kick.
+static void virtio_queue_request(virtio_blk_t* vb, u32 r, u32 type, u64 sector,
+                                 blk_segment_t* segs, u32 nsegs) {
+    virtio_request_t* req = &virtio_requests[r];
+    u16 head = vb->indirect ? r : r * VIRTIO_REQ_DESCS;
+    volatile virtq_desc_t* chain = vb->indirect ? req->table : &vb->desc[head];
+    u16 base = vb->indirect ? 0 : head;  // Chains link by index within their own table
+    u16 data_flags = (type == VIRTIO_BLK_T_IN) ? VIRTQ_DESC_F_WRITE : 0;
+    u32 n = 0;
+
+    req->header.type = type;
+    req->header.reserved = 0;
+    req->header.sector = sector;
+    req->status = 0xFF;
+
+    virtio_set_desc(&chain[n], &req->header, sizeof(req->header), VIRTQ_DESC_F_NEXT, base + n + 1);
+    n++;
+    for(u32 i = 0; i < nsegs; i++, n++) {
+        virtio_set_desc(&chain[n], segs[i].buffer, segs[i].count * 512,
+                        VIRTQ_DESC_F_NEXT | data_flags, base + n + 1);
+    }
+    virtio_set_desc(&chain[n], (void*)&req->status, 1, VIRTQ_DESC_F_WRITE, 0);
+    n++;
+
+    if(vb->indirect) {
+        virtio_set_desc(&vb->desc[head], req->table, n * sizeof(virtq_desc_t), VIRTQ_DESC_F_INDIRECT, 0);
+    }
+
+    vb->avail->ring[vb->avail_idx & (vb->queue_size - 1)] = head;
+    virtio_barrier();
+    vb->avail_idx++;
+    vb->avail->idx = vb->avail_idx;
+}
+
+static void virtio_blk_kick(blkdev_t* dev) {
+    virtio_blk_t* vb = (virtio_blk_t*)dev->driver;
+
+    virtio_barrier();
+    if(!(vb->used->flags & VIRTQ_USED_F_NO_NOTIFY)) outw(vb->io_base + VIRTIO_QUEUE_NOTIFY, 0);
+}
+
+// Hand finished requests back to the block queue
+static void virtio_collect(virtio_blk_t* vb) {
+    while(vb->used_idx != vb->used->idx) {
+        virtio_barrier();
+        u32 head = vb->used->ring[vb->used_idx & (vb->queue_size - 1)].id;
+        u32 r = vb->indirect ? head : head / VIRTIO_REQ_DESCS;
+        virtio_request_t* req = &virtio_requests[r];
+        vb->used_idx++;
+
+        vb->busy &= ~(1u << r);
+        if(req->cmd) {
+            if(req->status != 0) {
+                kprint("Error: virtio-blk request failed (status ");
+                kprint_hex(req->status);
+                kprint(")\n");
+            }
+            blkq_complete(req->cmd, req->status == 0);
+        }
+    }
+}
+
+static bool virtio_blk_start(blkdev_t* dev, blk_cmd_t* cmd) {
+    virtio_blk_t* vb = (virtio_blk_t*)dev->driver;
+    u32 r;
+
+    if(cmd->write && vb->read_only) {
+        blkq_complete(cmd, false);
+        return true;
+    }
+
+    for(r = 0; r < vb->depth; r++) {
+        if(!(vb->busy & (1u << r))) break;
+    }
+    if(r == vb->depth) return false;
+
+    vb->busy |= 1u << r;
+    virtio_requests[r].cmd = cmd;
+    virtio_queue_request(vb, r, cmd->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN,
+                         cmd->lba, cmd->segs, cmd->nsegs);
+    return true;
+}
+
+static void virtio_blk_poll(blkdev_t* dev) {
+    virtio_collect((virtio_blk_t*)dev->driver);
+}
+
+// Runs with the queue idle, so request slot 0 is free
+static bool virtio_blk_flush(blkdev_t* dev) {
+    virtio_blk_t* vb = (virtio_blk_t*)dev->driver;
+    u32 start = timer_ticks;
+
+    if(!vb->flush) return true;  // No volatile write cache
+    if(vb->busy) return false;
+
+    vb->busy |= 1;
+    virtio_requests[0].cmd = 0;
+    virtio_queue_request(vb, 0, VIRTIO_BLK_T_FLUSH, 0, 0, 0);
+    virtio_blk_kick(dev);
+
+    while(vb->busy & 1) {
+        if(timer_ticks - start > VIRTIO_TIMEOUT_TICKS) {
+            kprint("Error: virtio-blk flush timed out\n");
+            return false;
+        }
+        virtio_collect(vb);
+    }
+    return virtio_requests[0].status == 0;
+}
+
+// Reading the ISR status register acknowledges the interrupt
+static void virtio_blk_irq(void* context) {
+    virtio_blk_t* vb = (virtio_blk_t*)context;
+    if(inb(vb->io_base + VIRTIO_ISR_STATUS) & 1) blkq_notify();
+}
+
+void virtio_blk_init(void) {
+    virtio_blk_t* vb = &virtio_blk;
+    pci_device_t pci;
+
+    if(vb->io_base) return;  // Already set up
+    if(!pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, &pci)) return;
+
+    u32 bar0 = pci_read_bar(&pci, 0);
+    if(!(bar0 & 0x01)) return;  // Legacy interface lives in I/O space
+
+    pci_enable_bus_master(&pci);
+    u16 io = bar0 & 0xFFFC;
+
+    outb(io + VIRTIO_DEVICE_STATUS, 0);  // Reset
+    outb(io + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACK);
+    outb(io + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    u32 features = inl(io + VIRTIO_DEVICE_FEATURES);
+    features &= VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH | VIRTIO_F_INDIRECT_DESC;
+    outl(io + VIRTIO_GUEST_FEATURES, features);
+
+    outw(io + VIRTIO_QUEUE_SELECT, 0);
+    u16 size = inw(io + VIRTIO_QUEUE_SIZE);
+    if(size == 0 || size > VIRTIO_QUEUE_MAX || (size & (size - 1)) ||
+       (!(features & VIRTIO_F_INDIRECT_DESC) && size < VIRTIO_REQ_DESCS)) {
+        kprint("virtio-blk: unsupported queue size\n");
+        outb(io + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+        return;
+    }
+
+    for(u32 i = 0; i < sizeof(virtio_ring); i++) virtio_ring[i] = 0;
+    u32 avail_end = size * sizeof(virtq_desc_t) + 6 + size * 2;
+
+    vb->io_base = io;
+    vb->queue_size = size;
+    vb->indirect = (features & VIRTIO_F_INDIRECT_DESC) != 0;
+    vb->flush = (features & VIRTIO_BLK_F_FLUSH) != 0;
+    vb->read_only = (features & VIRTIO_BLK_F_RO) != 0;
+    vb->desc = (volatile virtq_desc_t*)virtio_ring;
+    vb->avail = (volatile virtq_avail_t*)(virtio_ring + size * sizeof(virtq_desc_t));
+    vb->used = (volatile virtq_used_t*)(virtio_ring + ((avail_end + 4095) & ~4095));
+    vb->avail_idx = 0;
+    vb->used_idx = 0;
+    vb->busy = 0;
+    vb->depth = vb->indirect ? size : size / VIRTIO_REQ_DESCS;
+    if(vb->depth > VIRTIO_REQUESTS) vb->depth = VIRTIO_REQUESTS;
+    vb->capacity = inl(io + VIRTIO_BLK_CAPACITY) | ((u64)inl(io + VIRTIO_BLK_CAPACITY + 4) << 32);
+
+    outl(io + VIRTIO_QUEUE_PFN, (u32)virtio_ring >> 12);
+
+    bool irq = irq_register(pci_interrupt_line(&pci), virtio_blk_irq, vb);
+    outb(io + VIRTIO_DEVICE_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    blkdev_t* dev = &vb->dev;
+    dev->name[0] = 'v';
+    dev->name[1] = 'd';
+    dev->name[2] = 'a';
+    dev->name[3] = '\0';
+    dev->sectors = vb->capacity;
+    dev->max_inflight = vb->depth;
+    dev->polled = !irq;
+    dev->start = virtio_blk_start;
+    dev->kick = virtio_blk_kick;
+    dev->poll = virtio_blk_poll;
+    dev->flush = virtio_blk_flush;
+    dev->driver = vb;
+    blkdev_register(dev);
+
+    kprint("virtio-blk: "); kprint_dec((u32)(vb->capacity >> 11)); kprint(" MB, queue ");
+    kprint_dec(size); kprint(", depth "); kprint_dec(vb->depth);
+    kprint(irq ? "\n" : ", polled\n");
+}
+
+void virtio_blk_print(void) {
+    virtio_blk_t* vb = &virtio_blk;
+    if(!vb->io_base) return;
+
+    kprint("vda: virtio-blk\n");
+    kprint("  Capacity: "); kprint_dec((u32)(vb->capacity >> 11)); kprint(" MB");
+    kprint(", queue depth "); kprint_dec(vb->depth);
+    kprint(vb->indirect ? ", indirect descriptors" : "");
+    kprint(vb->read_only ? ", read-only\n" : "\n");
+}